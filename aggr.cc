@@ -0,0 +1,141 @@
+/* --------------------------------------------
+ * Purpose: Frame aggregation (see aggr.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "tcv.h"
+#include "app.h"
+#include "aggr.h"
+
+word aggr_delay = AGGR_DELAY;
+
+// The batch being collected; word-aligned like a packet
+static word aggr_buf [AGGR_CAP / 2];
+static word aggr_fill;
+
+// Packet holding the record between aggr_reserve and aggr_commit when
+// records are not batched
+static address aggr_pkt;
+
+// Urgent frames that may still overtake waiting ones
+static byte aggr_credit;
+
+// Events: a record was added / the batch is full / the batch went out
+#define AGGR_EV_ADDED ((aword)&aggr_fill)
+#define AGGR_EV_FULL ((aword)&aggr_delay)
+#define AGGR_EV_SENT ((aword)aggr_buf)
+
+/*
+ * Purpose: Send the batch when it is full or its delay has expired.
+*/
+fsm aggr_tx {
+    /*
+     * Purpose: State for waiting for the first record of a batch.
+    */
+    state AG_Idle:
+        if (aggr_fill == 0) {
+            when(AGGR_EV_ADDED, AG_Idle);
+            release;
+        }
+        // Left over from before the delay was set to zero
+        if (aggr_delay == 0)
+            proceed AG_Flush;
+        // Give other records a chance to join
+        delay(aggr_delay, AG_Flush);
+        when(AGGR_EV_FULL, AG_Flush);
+        release;
+
+    /*
+     * Purpose: State for sending the batch in one frame.
+    */
+    state AG_Flush:
+        address spkt = tcv_wnp(AG_Flush, sfd, (MSG_FRAME_OVH + aggr_fill + 1) & ~1);
+        // The mesh header is filled in by the plugin
+        memset(spkt, 0, MSG_FRAME_HDR);
+        memcpy(frame_recs(spkt), aggr_buf, aggr_fill);
+        // Terminate the record list in the padding byte, if any
+        if (aggr_fill & 1)
+            frame_recs(spkt) [aggr_fill] = 0;
+        tcv_endp(spkt);
+        aggr_fill = 0;
+        trigger(AGGR_EV_SENT);
+        proceed AG_Idle;
+}
+
+void aggr_init () {
+    aggr_fill = 0;
+    aggr_pkt = NULL;
+    aggr_credit = AGGR_URGENT_BURST;
+    runfsm aggr_tx;
+}
+
+/*
+ * Purpose: Decide whether the frame of an urgent record may overtake the
+ *          frames waiting in the TCV queue.
+*/
+static Boolean aggr_overtake () {
+    // Nobody is waiting, so nobody can starve
+    if (tcv_qsize(sfd, TCV_DSP_XMT) == 0)
+        aggr_credit = AGGR_URGENT_BURST;
+    if (aggr_credit == 0) {
+        // Let the waiting frames go first this time
+        aggr_credit = AGGR_URGENT_BURST;
+        return NO;
+    }
+    aggr_credit--;
+    return YES;
+}
+
+/*
+ * Purpose: Return a record of the given kind for receiverId with room for
+ *          len payload bytes. The header is filled in, with sequence
+ *          number seq (a retransmission) or, for AGGR_NEWSEQ, the next
+ *          one; the caller writes the payload and passes the record to
+ *          aggr_commit before releasing the CPU. If there is no room yet,
+ *          the caller is resumed in state st. For an urgent record, ahead
+ *          keeps the caller's overtaking decision (AGGR_*) until then.
+*/
+struct msg *aggr_reserve (word st, byte kind, word receiverId, word len, word seq,
+            byte *ahead) {
+    struct msg *m;
+
+    if (aggr_delay == 0 || (kind & MSG_URGENT)) {
+        // No batching: the record gets a packet of its own. Whether an
+        // urgent one overtakes is decided once, not on every retry while
+        // waiting for the packet
+        if ((kind & MSG_URGENT) && *ahead == AGGR_UNDECIDED)
+            *ahead = aggr_overtake() ? AGGR_AHEAD : AGGR_BEHIND;
+        aggr_pkt = tcv_wnps(st, sfd, (MSG_FRAME_OVH + MSG_HDR_LEN + len + 1) & ~1,
+            *ahead == AGGR_AHEAD);
+        *ahead = AGGR_UNDECIDED;
+        memset(aggr_pkt, 0, MSG_FRAME_HDR);
+        m = (struct msg*)frame_recs(aggr_pkt);
+    } else {
+        if (aggr_fill + MSG_HDR_LEN + len > AGGR_CAP) {
+            trigger(AGGR_EV_FULL);
+            when(AGGR_EV_SENT, st);
+            release;
+        }
+        m = (struct msg*)((byte*)aggr_buf + aggr_fill);
+    }
+
+    m->kind = kind;
+    msg_putw(m->senderId, nodeId);
+    msg_putw(m->receiverId, receiverId);
+    m->length = (byte)len;
+    if (seq == AGGR_NEWSEQ)
+        seq = sequence++;
+    msg_putw(m->sequenceNumber, seq);
+    return m;
+}
+
+void aggr_commit (struct msg *m) {
+    if (aggr_pkt != NULL) {
+        if ((MSG_HDR_LEN + m->length) & 1)
+            m->payload [m->length] = 0;
+        tcv_endp(aggr_pkt);
+        aggr_pkt = NULL;
+        return;
+    }
+    aggr_fill += MSG_HDR_LEN + m->length;
+    trigger(AGGR_EV_ADDED);
+}
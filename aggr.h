@@ -0,0 +1,52 @@
+/* --------------------------------------------
+ * Purpose: Frame aggregation. Outgoing records (header + payload, see
+ *          struct msg) are collected into a batch and sent together in
+ *          one frame, to any mix of receivers. The batch goes out when
+ *          the next record does not fit, or aggr_delay msec after its
+ *          first record was added. A zero kind byte after the last
+ *          record pads the frame to an even length.
+ *
+ *          Urgent records (MSG_URGENT in the kind) are not batched: each
+ *          one goes out at once in a frame of its own, queued with the
+ *          TCV urgent attribute ahead of the normal frames waiting for
+ *          the PHY. So that normal traffic is not starved by a stream of
+ *          urgent frames, at most AGGR_URGENT_BURST of them in a row may
+ *          overtake waiting frames; the next one then joins the end of
+ *          the queue.
+ -----------------------------------------------*/
+#ifndef __aggr_h__
+#define __aggr_h__
+
+#include "sysio.h"
+#include "app.h"
+
+// Default batching delay (msec)
+#ifndef AGGR_DELAY
+#define AGGR_DELAY 10
+#endif
+
+// Urgent frames that may overtake waiting frames in a row
+#ifndef AGGR_URGENT_BURST
+#define AGGR_URGENT_BURST 4
+#endif
+
+// Room for records in one frame
+#define AGGR_CAP (CC1350_BUF_SZ - MSG_FRAME_OVH)
+
+// Sequence number argument of aggr_reserve: take the next one
+#define AGGR_NEWSEQ WNONE
+
+// Overtaking decision of an urgent record, kept by every caller of
+// aggr_reserve while it waits for a packet (a static fsm local starts
+// out undecided)
+#define AGGR_UNDECIDED 0
+#define AGGR_BEHIND 1
+#define AGGR_AHEAD 2
+
+extern word aggr_delay;
+
+void aggr_init (void);
+struct msg *aggr_reserve (word, byte, word, word, word, byte*);
+void aggr_commit (struct msg*);
+
+#endif
@@ -15,113 +15,394 @@
 #include "serf.h"
 #include "ser.h"
 #include "phys_cc1350.h"
-#include "plug_null.h"
+#include "plug_mesh.h"
 #include "tcv.h"
 #include "tcvphys.h"
-
-// Set buffer size
-#define CC1350_BUF_SZ 250
-
-// A. Message Structure:
-struct msg {
-    byte senderId; // 1 byte
-    byte receiverId; // 1 byte
-    byte sequenceNumber; // 1 byte
-    byte payload[27]; // 27 bytes
-};
+#include "app.h"
+#include "mstime.h"
+#include "bench.h"
+#include "pool.h"
+#include "frag.h"
+#include "aggr.h"
+#include "rcv.h"
+#include "rel.h"
+#include "dup.h"
+#include "uout.h"
+#include "hlink.h"
+#include "fmt.h"
+#include "grp.h"
+#include "reo.h"
+#include "sfq.h"
+#include "his.h"
 
 // Define Global Variables 
-byte nodeId; 
-int sequence = 0;
+word nodeId;
+word sequence = 0;
 
 /* session descriptor for the single VNETI session */
 int sfd;
 
+// A message is being sent (by the menu, the host link or sfq_drain)
+static Boolean send_busy;
+#define SEND_EV_IDLE ((aword)&send_busy)
+
 // --------------------- B. Program Operation ---------------------------------
 /* 
  *  Purpose: Define a finiste state machine for receiving and processing messages.
 */
 fsm receiver {
-    // Address of the received packet 
-    address packet;
-    // Pointer to the received message
-    struct msg * receivedPtr;
+    // The received packet being walked
+    rcvpkt_t rpkt;
+    // View of the current record in the packet
+    msgview_t view;
+    // Text of the message to show: in the packet or reassembled from
+    // fragments
+    const char * text;
+    fragmsg_t * reassembled;
+    word textLen, textOut;
+    // Benchmark sequence number and latency of the received message
+    word benchSeq, benchLat;
+    // Whether an urgent ACK overtakes (see aggr_reserve)
+    byte ackAhead;
 
     /*
      * Purpose: State for waiting to receive a packet
     */
     state Receiving:
-        // Receive a packet
-        packet = tcv_rnp(Receiving, sfd);
+        // With records held for in-order delivery, also wake up when the
+        // first of them times out (only if about to block, so that the
+        // timer cannot fire in the middle of another state)
+        if (reo_held() && tcv_qsize(sfd, TCV_DSP_RCV) == 0)
+            delay(reo_wait(), Reorder);
+        // Receive a packet, unless it is to give way to a newer one at
+        // the queue limit (see plug_mesh.h)
+        address pkt = tcv_rnp(Receiving, sfd);
+        if (mesh_rxdrop(sfd, pkt)) {
+            tcv_endp(pkt);
+            proceed Receiving;
+        }
+        rcv_open(&rpkt, pkt);
+        // Give back the buffers of reassemblies their senders gave up
+        frag_expire();
     
     /*
      * Purpose:  State for processing a received message.
     */
     state Receive_Msg:
-        //Get the pointer to the received message
-        receivedPtr = (struct msg *)(packet + 1);
-
-        // Check if the message is directed to this node
-        if(receivedPtr->receiverId == nodeId) {
-            proceed Direct; // Proceed to handling direct message
-        } else if (receivedPtr->receiverId == '0' || receivedPtr->receiverId == 0) {
-            proceed Broadcast; // Proceed to handling broadcast message
+        // Get the next record; the packet is released after the last one
+        if (!rcv_next(&rpkt, &view))
+            proceed Reorder;
+
+        // Skip records that are not for this node
+        // (the plugin only drops frames with no such record at all);
+        // their numbers must not hold up those after them
+        if (!msg_for_me(view.receiverId)) {
+            if (reo_hol != 0)
+                reo_skip(view.senderId, view.sequenceNumber);
+            proceed Receive_Msg;
         }
-        // Continue receiving if message is not for this node
-        proceed Receiving;
-    
+
+        // Acknowledgements complete a reliable send
+        if (msg_kind(view.kind) == MSG_KIND_ACK) {
+            if (reo_hol != 0)
+                reo_skip(view.senderId, view.sequenceNumber);
+            rel_ack(view.senderId, view.data, view.len);
+            proceed Receive_Msg;
+        }
+
+        // Acknowledge reliable direct records before handling them
+        if ((view.kind & MSG_ACKREQ) && view.receiverId == nodeId)
+            proceed Send_Ack;
+
     /*
-     * Purpose: State for handling a direct message.
+     * Purpose: State for screening out copies and records out of order.
     */
-    state Direct:
-        ser_outf(Receive_Msg, "Message ");
-        proceed Show_Message;
-    
+    state Dispatch:
+        // Drop retransmissions and other copies of records already seen
+        if (dup_check(view.senderId, view.sequenceNumber))
+            proceed Receive_Msg;
+
+        // In order delivery: records ahead of their sender's next one wait
+        if (reo_hol != 0 && !reo_check(&view))
+            proceed Receive_Msg;
+
     /*
-     * Purpose: State for handling a broadcast message.
+     * Purpose: State for handing the record to its consumer.
     */
-    state Broadcast:
-        ser_outf(Broadcast, "Broadcast ");
+    state Deliver:
+        reassembled = NULL;
+        if (msg_kind(view.kind) == MSG_KIND_FRAG) {
+            // Keep collecting until the message is complete
+            reassembled = frag_rx(view.senderId, view.data, view.len, &textLen);
+            if (reassembled == NULL)
+                proceed Receive_Msg;
+            text = NULL;
+        } else if (msg_kind(view.kind) == MSG_KIND_DATA) {
+            text = view.data;
+            textLen = view.len;
+        } else if (msg_kind(view.kind) == MSG_KIND_BENCH) {
+            // Benchmark traffic is accounted for instead of being shown
+            if (bench_rx(view.senderId, view.data, view.len, &benchSeq, &benchLat))
+                proceed Bench_Msg;
+            proceed Receive_Msg;
+        } else {
+            proceed Receive_Msg;
+        }
+        textOut = 0;
+
+        // Keep the message (or the start of a long one) in the history
+        const char * ht = text;
+        word hn = textLen;
+        if (reassembled != NULL)
+            ht = frag_text(reassembled, 0, &hn);
+        his_add(&view, ht, hn);
 
     /*
-     * Purpose: State for displaying the received message.
+     * Purpose: State for displaying the received message. The whole message
+     *          (header line, text and line end) is queued for the console
+     *          without waiting; if the console is too far behind, all of
+     *          it is dropped.
     */
     state Show_Message:
-        ser_outf(Show_Message, "Message from node %d (Seq %d): %s\n\r", receivedPtr->senderId, receivedPtr->sequenceNumber, receivedPtr->payload);
-        tcv_endp(packet);
-        // Return to receiving state for more messages
+        if (hlink_on)
+            proceed Link_Message;
+        // Formatted by straight-line code rather than vform (see fmt.h)
+        char line [FMT_SHOW_MAX];
+        word n = fmt_show(line, &view);
+        if (n + textLen + 2 > UOUT_SIZE)
+            proceed Show_Long;
+        if (!uout_reserve(n + textLen + 2))
+            proceed Show_Done;
+        uout_put(line, n);
+        while (textOut < textLen) {
+            n = textLen - textOut;
+            const char * t = reassembled != NULL ?
+                frag_text(reassembled, textOut, &n) : text + textOut;
+            uout_put(t, n);
+            textOut += n;
+        }
+        uout_put("\n\r", 2);
+        proceed Show_Done;
+
+    /*
+     * Purpose: State for writing out the header line of a message too long
+     *          for the ring, waiting for the console.
+    */
+    state Show_Long:
+        char line [FMT_SHOW_MAX];
+        uout_write(Show_Long, line, fmt_show(line, &view));
+
+    /*
+     * Purpose: State for writing out the text, exactly textLen bytes.
+    */
+    state Show_Text:
+        if (textOut < textLen) {
+            word n = textLen - textOut;
+            const char * t = reassembled != NULL ?
+                frag_text(reassembled, textOut, &n) : text + textOut;
+            if (n > UOUT_SIZE)
+                n = UOUT_SIZE;
+            uout_write(Show_Text, t, n);
+            textOut += n;
+            proceed Show_Text;
+        }
+
+    /*
+     * Purpose: State for ending the line.
+    */
+    state Show_End:
+        uout_write(Show_End, "\n\r", 2);
+
+    /*
+     * Purpose: State for releasing the message.
+    */
+    state Show_Done:
+        // A reassembled message lives in pool buffers
+        if (reassembled != NULL)
+            frag_free(reassembled);
+        proceed Receive_Msg;
+
+    /*
+     * Purpose: State for delivering the held records that are due.
+    */
+    state Reorder:
+        if (reo_held() && reo_next(&view))
+            proceed Deliver;
         proceed Receiving;
+
+    /*
+     * Purpose: State for passing the received message to the host link.
+    */
+    state Link_Message:
+        byte hdr [8];
+        hdr [0] = HLINK_RECV;
+        hdr [1] = view.kind;
+        msg_putw(hdr + 2, view.senderId);
+        msg_putw(hdr + 4, view.receiverId);
+        msg_putw(hdr + 6, view.sequenceNumber);
+        hlink_begin(Link_Message, hdr, sizeof(hdr));
+
+    /*
+     * Purpose: State for framing the text, exactly textLen bytes.
+    */
+    state Link_Text:
+        if (textOut < textLen) {
+            word n = textLen - textOut;
+            const char * t = reassembled != NULL ?
+                frag_text(reassembled, textOut, &n) : text + textOut;
+            textOut += hlink_put(Link_Text, t, n);
+            proceed Link_Text;
+        }
+
+    /*
+     * Purpose: State for ending the record.
+    */
+    state Link_End:
+        hlink_end(Link_End);
+        proceed Show_Done;
+
+    /*
+     * Purpose: State for reporting a received benchmark message.
+    */
+    state Bench_Msg:
+        // The host link has no room for benchmark lines
+        if (!hlink_on) {
+            char line [FMT_SHOW_MAX];
+            uout_put(line, fmt_rx(line, view.senderId, benchSeq, benchLat));
+        }
+        proceed Receive_Msg;
+
+    /*
+     * Purpose: State for acknowledging a reliable record.
+    */
+    state Send_Ack:
+        // The acknowledgement of an urgent record is urgent too
+        struct msg * ack = aggr_reserve(Send_Ack, MSG_KIND_ACK | (view.kind & MSG_URGENT),
+            view.senderId, REL_ACK_LEN, AGGR_NEWSEQ, &ackAhead);
+        word map = rel_sack(view.senderId, view.sequenceNumber);
+        msg_putw(ack->payload, view.sequenceNumber);
+        msg_putw(ack->payload + 2, map);
+        aggr_commit(ack);
+        proceed Dispatch;
 }
 
 /*
  * Purpose: Finite state machine for sending messages.
 */
-fsm send(struct msg * ptr) {
+fsm send(struct outmsg * ptr) {
+    // Next fragment to send and the number of records (1 = not fragmented)
+    byte frag, nrecs;
+    // Message ID shared by all fragments of one message
+    byte fragId;
+    // Reliable mode: records are tracked in the window until acknowledged
+    Boolean reliable;
+    // Record being (re)sent: fragment, sequence number (AGGR_NEWSEQ for a
+    // first transmission) and window slot
+    byte curFrag;
+    word curSeq;
+    int curSlot;
+    // Whether the urgent record overtakes (see aggr_reserve)
+    byte ahead;
+
     /*
-     * Purpose: State for sending a message.
+     * Purpose: State for deciding whether the message needs fragments.
+    */
+    state Send_Start:
+        // One message at a time: the locals and the window are shared
+        if (send_busy) {
+            when(SEND_EV_IDLE, Send_Start);
+            release;
+        }
+        send_busy = YES;
+        frag = 0;
+        nrecs = ptr->length > MAX_PAYLOAD ? frag_count(ptr->length) : 1;
+        fragId++;
+        // Broadcasts and multicasts are never acknowledged
+        reliable = rel_enabled && msg_unicast(ptr->receiverId);
+        if (reliable)
+            rel_start(ptr->receiverId);
+
+    /*
+     * Purpose: State for sending the next record while the window has room.
+    */
+    state Send_Next:
+        if (frag == nrecs) {
+            if (!reliable || rel_idle())
+                proceed Send_Done;
+            proceed Send_Wait;
+        }
+        if (reliable && (rel_expired() >= 0 || (curSlot = rel_slot()) < 0))
+            proceed Send_Wait;
+        curFrag = frag++;
+        curSeq = AGGR_NEWSEQ;
+
+    /*
+     * Purpose: State for sending (or resending) the current record.
     */
     state Send_Msg:
-        // Create a new packet to send
-        address spkt = tcv_wnp(Send_Msg, sfd, sizeof(struct msg) + 4);
-        
-        // Initialize the packet
-        spkt [0] = 0;
-        byte * p = (byte*)(spkt + 1);
-
-        // Populate the packet with message data
-        *p = ptr->senderId; p++;
-        *p = ptr->receiverId; p++;
-        *p = ptr->sequenceNumber; p++;
-        strcpy(p, ptr->payload);
-
-        // Increment the message sequence number
-        sequence++;
-
-        // Output a confirmation message
-        tcv_endp (spkt);
-        ser_outf(Send_Msg, "\n\rMessage Sent\n\r");
+        // Reserve the record in the outgoing frame; the header comes
+        // filled in and the payload is written in place
+        struct msg * m;
+        byte flags = (reliable ? MSG_ACKREQ : 0) |
+            (ptr->prio == MSG_PRIO_URGENT ? MSG_URGENT : 0);
+        if (nrecs > 1) {
+            m = aggr_reserve(Send_Msg, MSG_KIND_FRAG | flags, ptr->receiverId,
+                frag_size(ptr->length, curFrag), curSeq, &ahead);
+            frag_put(m->payload, ptr, fragId, curFrag);
+        } else {
+            m = aggr_reserve(Send_Msg, ptr->kind | flags, ptr->receiverId, ptr->length,
+                curSeq, &ahead);
+            memcpy(m->payload, ptr->text, ptr->length);
+        }
+        curSeq = msg_getw(m->sequenceNumber);
+        aggr_commit(m);
+        if (reliable)
+            rel_track(curSlot, curSeq, curFrag);
+        proceed Send_Next;
+
+    /*
+     * Purpose: State for retransmitting expired records and otherwise
+     *          waiting for acknowledgements.
+    */
+    state Send_Wait:
+        if ((curSlot = rel_expired()) >= 0) {
+            if (rel_tries(curSlot) >= REL_RETRIES)
+                proceed Send_Failed;
+            // Only this record is resent, with its original sequence number
+            curFrag = rel_frag(curSlot);
+            curSeq = rel_seq(curSlot);
+            proceed Send_Msg;
+        }
+        if (rel_idle() || (frag < nrecs && rel_slot() >= 0))
+            proceed Send_Next;
+        when(REL_EV_ACK, Send_Next);
+        delay(rel_wait(), Send_Wait);
+        release;
+
+    /*
+     * Purpose: State for confirming the transmission.
+    */
+    state Send_Done:
+        ptr->result = reliable ? MSG_RES_DELIVERED : MSG_RES_SENT;
+        // Output a confirmation message (the host link reports the result,
+        // the traffic test its totals)
+        if (!hlink_on && ptr->kind != MSG_KIND_BENCH)
+            uout_serf(Send_Done, reliable ? "\n\rMessage Delivered\n\r" : "\n\rMessage Sent\n\r");
 
         // Finish the state machine
+        send_busy = NO;
+        trigger(SEND_EV_IDLE);
+        finish;
+
+    /*
+     * Purpose: State for reporting that the receiver never acknowledged.
+    */
+    state Send_Failed:
+        ptr->result = MSG_RES_FAILED;
+        if (!hlink_on && ptr->kind != MSG_KIND_BENCH)
+            uout_serf(Send_Failed, "\n\rDelivery Failed\n\r");
+        send_busy = NO;
+        trigger(SEND_EV_IDLE);
         finish;
 }
 
@@ -129,23 +410,46 @@ fsm send(struct msg * ptr) {
  * Purpose:  Root state machine for managing the P2P chat application.
 */
 fsm root {
-    byte receiverId;
-    struct msg * ptr;
+    word receiverId;
+    // Priority class of the messages typed in
+    byte prio;
+    struct outmsg * ptr;
+    // Scratch for ser_inf "%d", which stores a full word
+    word id;
+    // Formatting times (msec) measured by fmt_bench: vform, fmt_show,
+    // and the lines timed so far
+    lword fmtv, fmtf;
+    word fmtn;
+    // Message of a history query being printed
+    hisent_t hent;
 
     /*
      * Purpose: Initialization state to set up the application.
     */
     state INIT:
-        // Set node ID to default value and reset sequence
-        nodeId = 1;
-        sequence = 0;
+        // Take the node ID from the host ID when it is a valid one (every
+        // simulated node gets its own), otherwise use the default value
+        nodeId = (host_id >= 1 && host_id <= MAX_NODE_ID) ? (word)host_id : 1;
+        // Start the sequence at random, so that receivers still holding
+        // the numbers sent before a reboot do not take new records for
+        // copies (see dup.h)
+        sequence = rnd();
+        // Typed messages are normal until switched to urgent
+        prio = MSG_PRIO_NORMAL;
+        // Start the console output
+        uout_init();
+        // Start the clock and clear the benchmark statistics
+        mstime_init();
+        bench_init();
+        // Set up the buffer pool for reassembly
+        pool_init();
         // Allocate memory for the message
-        ptr = (struct Message *) umalloc(sizeof(struct msg));
+        ptr = (struct outmsg *) umalloc(sizeof(struct outmsg));
         // Set up cc1350 board
         phys_cc1350(0, CC1350_BUF_SZ);
 
-        // Load null plug-in
-        tcv_plug(0, &plug_null);
+        // Load the mesh plug-in, which relays frames for other nodes
+        tcv_plug(0, &plug_mesh);
 
         // Open the TCV session
         sfd = tcv_open(NONE, 0, 0);
@@ -159,6 +463,12 @@ fsm root {
         // Enable physical options and run receiver state machine
         tcv_control(sfd, PHYSOPT_ON, NULL);
         runfsm receiver;
+        // Start collecting outgoing records into frames
+        aggr_init();
+        // Recover the flash queue and forward what it holds
+        runfsm sfq_drain;
+        // Recover the message history
+        runfsm his_wr;
 
     /*
      * Purpose: State to display the main menu.
@@ -167,11 +477,29 @@ fsm root {
         // Reset receiver ID
         receiverId = 0;
         // Display the menu
-        ser_outf(Menu, "\n\rP2P Chat (Node #%d)\n\r"
+        uout_serf(Menu, "\n\rP2P Chat (Node #%d)\n\r"
                        "(C)hange node ID\n\r"
                        "(D)irect transmission\n\r"
                        "(B)roadcast transmission\n\r"
-                       "Selection: ", nodeId);
+                       "(T)raffic test\n\r"
+                       "(S)tatistics\n\r"
+                       "(A)ggregation delay (%u ms)\n\r"
+                       "(R)eliable direct transmission (%s)\n\r"
+                       "(P)riority (%s)\n\r"
+                       "(F)lood suppression (k %u, p %u%%, delay %u ms)\n\r"
+                       "(Q)ueue limit (%u, drop %s)\n\r"
+                       "(H)ost link (binary)\n\r"
+                       "(M)easure message formatting\n\r"
+                       "(G)roups (%u joined)\n\r"
+                       "(O)rdered delivery (%u ms, 0 = off)\n\r"
+                       "(U)nacknowledged messages to flash (%s, %u queued)\n\r"
+                       "(L)og of received messages\n\r"
+                       "Selection: ", nodeId, aggr_delay, rel_enabled ? "on" : "off",
+                       prio == MSG_PRIO_URGENT ? "urgent" : "normal",
+                       mesh_k, mesh_prob, mesh_rad, mesh_rxcap(sfd),
+                       mesh_rxpolicy(sfd) == MESH_RXQ_OLDEST ? "oldest" :
+                       mesh_rxpolicy(sfd) == MESH_RXQ_PRIO ? "by priority" : "newest",
+                       grp_joined, reo_hol, sfq_on ? "on" : "off", sfq_stat.queued);
     /*
      * Purpose: State to handle user input choice.
     */
@@ -196,9 +524,78 @@ fsm root {
             case 'B':
                 proceed Broadcast_Transmission;
                 break;
+
+            // Benchmark traffic
+            case 'T':
+                proceed Traffic_Test;
+                break;
+
+            // Benchmark statistics
+            case 'S':
+                proceed Statistics;
+                break;
+
+            // Batching delay of outgoing frames
+            case 'A':
+                proceed Aggregation;
+                break;
+
+            // Toggle acknowledged direct transmissions
+            case 'R':
+                rel_enabled = !rel_enabled;
+                proceed Menu;
+                break;
+
+            // Toggle the priority class of typed messages
+            case 'P':
+                prio = prio == MSG_PRIO_URGENT ? MSG_PRIO_NORMAL : MSG_PRIO_URGENT;
+                proceed Menu;
+                break;
+
+            // Rebroadcast suppression of relayed floods
+            case 'F':
+                proceed Flooding;
+                break;
+
+            // Binary mode for a gateway program, until it exits
+            case 'H':
+                call hlink_rx(ptr, Menu);
+                break;
+
+            // Microbenchmark of the received message header line
+            case 'M':
+                proceed Fmt_Bench;
+                break;
+
+            // Receive queue limit and drop policy
+            case 'Q':
+                proceed Queue_Limit;
+                break;
+
+            // Multicast groups: join, leave, send
+            case 'G':
+                proceed Groups;
+                break;
+
+            // In-order delivery and its head-of-line timeout
+            case 'O':
+                proceed Ordering;
+                break;
+
+            // Toggle queueing unacknowledged messages in flash
+            case 'U':
+                sfq_on = !sfq_on;
+                proceed Menu;
+                break;
+
+            // Query the history of received messages
+            case 'L':
+                proceed History;
+                break;
+
             // Display error message for incorrect option
             default:
-                ser_outf(Choice, "\n\rIncorrect Option.");
+                uout_serf(Choice, "\n\rIncorrect Option.");
                 // Return to the main menu
                 proceed Menu;
                 break;
@@ -207,19 +604,20 @@ fsm root {
      * Purpose: State to prompt user to enter a new node ID.
     */
     state Change_ID:
-        ser_outf(Change_ID, "\n\rNew node ID (1-25):");
+        uout_serf(Change_ID, "\n\rNew node ID (1-%d):", MAX_NODE_ID);
 
     /*
      * Purpose: State to get and validate the new node ID entered by the user.
     */
     state Get_ChangeID:
-        ser_inf(Get_ChangeID, "%d", &nodeId);
+        ser_inf(Get_ChangeID, "%d", &id);
             // Check if the entered node ID is valid
-            if (nodeId < 1 || nodeId > 25) {
-                ser_outf(Get_ChangeID, "\n\rInvalid ID");
+            if (id < 1 || id > MAX_NODE_ID) {
+                uout_serf(Get_ChangeID, "\n\rInvalid ID");
                 // Retry getting a valid ID
                 proceed Change_ID;
             }
+            nodeId = (word)id;
             // Return to the main menu after successful ID change
             proceed Menu;
 
@@ -227,47 +625,355 @@ fsm root {
      * Purpose: State to prompt user to enter the receiver node ID for direct transmission.
     */
     state Direct_Transmission:
-        ser_outf(Direct_Transmission, "\n\rReceiver node ID (1-25):");
+        uout_serf(Direct_Transmission, "\n\rReceiver node ID (1-%d):", MAX_NODE_ID);
     
     /*
      * Purpose: State to get and validate the receiver node ID entered by the user.
     */
     state Get_ReceiverID:
-        ser_inf(Get_ReceiverID, "%d", &receiverId);
+        ser_inf(Get_ReceiverID, "%d", &id);
             // Check if the entered receiver ID is valid
-            if (receiverId < 1 || receiverId > 25) {
+            if (id < 1 || id > MAX_NODE_ID) {
                 // Display error message for invalid ID
-                ser_outf(Get_ReceiverID, "\n\rInvalid ID");
+                uout_serf(Get_ReceiverID, "\n\rInvalid ID");
                 // Retry getting a valid receiver ID
                 proceed Direct_Transmission;
             }
+            receiverId = (word)id;
 
     /*
      * Purpose: State to prompt user to enter the message for broadcast transmission.
     */
     state Broadcast_Transmission:
-        ser_outf(Broadcast_Transmission, "\n\rMessage: ");
+        uout_serf(Broadcast_Transmission, "\n\rMessage: ");
     
     /*
      * Purpose: State to receive and process the message entered by the user.
     */
     state Receive_Msg:
-        ser_in(Receive_Msg, ptr->payload, 27);
-        if(strlen(ptr->payload) >= 27) {
-            // Ensure message is null-terminated
-            ptr->payload[26] = '\0';
-        }
+        ser_in(Receive_Msg, ptr->text, MAX_MSG_LEN + 1);
+        // Only the characters actually entered are sent
+        ptr->length = strlen(ptr->text);
 
     /*
      * Purpose: State to send the message after receiving input and validating receiver ID.
     */
     state Sending:
-        // Set sender ID
-        ptr->senderId = nodeId;
-        // Set receiver ID
+        // Set receiver ID; the sender ID and sequence numbers are added
+        // to every frame by send
         ptr->receiverId = receiverId;
-        // Set sequence number
-        ptr->sequenceNumber = (byte)sequence;
+        ptr->kind = MSG_KIND_DATA;
+        ptr->prio = prio;
         // Call send finite state machine to transmit the message
-        call send(ptr, Menu);
+        call send(ptr, Sent);
+
+    /*
+     * Purpose: State to keep a message that was not acknowledged in flash.
+    */
+    state Sent:
+        if (ptr->result == MSG_RES_FAILED && sfq_on)
+            call sfq_put(ptr, Queued);
+        proceed Menu;
+
+    /*
+     * Purpose: State to confirm that the message is queued.
+    */
+    state Queued:
+        if (ptr->result == MSG_RES_QUEUED)
+            uout_serf(Queued, "\n\rQueued until node %u is heard from\n\r", ptr->receiverId);
+        proceed Menu;
+
+    /*
+     * Purpose: State to prompt user for the benchmark parameters.
+    */
+    state Traffic_Test:
+        uout_serf(Traffic_Test, "\n\rReceiver (0 = broadcast), mode (F/B/S), count, interval (ms), length (%d-%d):",
+            BENCH_HDR_LEN, MAX_PAYLOAD);
+
+    /*
+     * Purpose: State to read and validate the benchmark parameters and run it.
+    */
+    state Get_Traffic:
+        word rcv, count, interval, length;
+        char mode;
+        ser_inf(Get_Traffic, "%u %c %u %u %u", &rcv, &mode, &count, &interval, &length);
+        bench_par.receiverId = rcv;
+        bench_par.mode = toupper((unsigned char)mode);
+        bench_par.count = count;
+        bench_par.interval = interval;
+        bench_par.length = length;
+        if (!bench_valid(&bench_par)) {
+            uout_serf(Get_Traffic, "\n\rInvalid parameters");
+            proceed Traffic_Test;
+        }
+        // The messages go out with the current priority
+        bench_par.out = ptr;
+        ptr->prio = prio;
+        call bench_tx(&bench_par, Menu);
+
+    /*
+     * Purpose: State to print and reset the benchmark receive statistics.
+    */
+    state Statistics:
+        lword elapsed = bench_stat.last - bench_stat.first;
+        uout_serf(Statistics, "\n\r# rxsum,received,lost,elapsed_ms,msgs_per_s,lat_min,lat_avg,lat_max\n\r"
+            "rxsum,%u,%u,%lu,%lu,%u,%lu,%u\n\r",
+            bench_stat.received, bench_stat.lost, elapsed,
+            elapsed ? (lword)bench_stat.received * 1000 / elapsed : 0,
+            bench_stat.latmin,
+            bench_stat.received ? bench_stat.latsum / bench_stat.received : 0,
+            bench_stat.latmax);
+
+    /*
+     * Purpose: State to print and reset the duplicate suppression counters.
+    */
+    state Dup_Statistics:
+        uout_serf(Dup_Statistics, "# dup,hits,misses,evictions\n\r"
+            "dup,%lu,%lu,%lu\n\r", dup_stat.hits, dup_stat.misses, dup_stat.evictions);
+
+    /*
+     * Purpose: State to print and reset the mesh plugin's counters.
+    */
+    state Mesh_Statistics:
+        uout_serf(Mesh_Statistics, "# mesh,accepted,filtered,seen,forwarded,suppressed,dropped\n\r"
+            "mesh,%lu,%lu,%lu,%lu,%lu,%lu\n\r", mesh_stat.accepted, mesh_stat.filtered,
+            mesh_stat.seen, mesh_stat.forwarded, mesh_stat.suppressed, mesh_stat.dropped);
+
+    /*
+     * Purpose: State to print the receive queue drop counters.
+    */
+    state Rxq_Statistics:
+        uout_serf(Rxq_Statistics, "# rxq,limit,queued,dropped_newest,dropped_oldest,dropped_prio\n\r"
+            "rxq,%u,%d,%lu,%lu,%lu\n\r", mesh_rxcap(sfd), tcv_qsize(sfd, TCV_DSP_RCV),
+            mesh_stat.rxqnewest, mesh_stat.rxqoldest, mesh_stat.rxqprio);
+
+    /*
+     * Purpose: State to print and reset the buffer pool statistics.
+    */
+    state Pool_Statistics:
+        uout_serf(Pool_Statistics, "# pool,buffers,used,max_used,failed\n\r"
+            "pool,%u,%u,%u,%u\n\r", POOL_BUFS, pool_stat.used,
+            pool_stat.maxused, pool_stat.failed);
+
+    /*
+     * Purpose: State to print the in-order delivery statistics.
+    */
+    state Reo_Statistics:
+        uout_serf(Reo_Statistics, "# reo,hol_ms,bytes,held,max_held,late,timeouts,overflows\n\r"
+            "reo,%u,%u,%u,%u,%lu,%lu,%lu\n\r", reo_hol, (word)REO_MEM,
+            reo_stat.held, reo_stat.maxheld, reo_stat.late, reo_stat.timeouts,
+            reo_stat.overflows);
+
+    /*
+     * Purpose: State to print the flash queue statistics.
+    */
+    state Sfq_Statistics:
+        uout_serf(Sfq_Statistics, "# sfq,queued,stored,forwarded,dropped,pages,erases\n\r"
+            "sfq,%u,%lu,%lu,%lu,%lu,%lu\n\r", sfq_stat.queued, sfq_stat.stored,
+            sfq_stat.forwarded, sfq_stat.dropped, sfq_stat.pages, sfq_stat.erases);
+
+    /*
+     * Purpose: State to print the message history statistics.
+    */
+    state His_Statistics:
+        uout_serf(His_Statistics, "# his,stored,dropped,pages,erases\n\r"
+            "his,%lu,%lu,%lu,%lu\n\r", his_stat.stored, his_stat.dropped,
+            his_stat.pages, his_stat.erases);
+
+    /*
+     * Purpose: State to print and reset the console output statistics.
+    */
+    state Uout_Statistics:
+        uout_serf(Uout_Statistics, "# uout,size,used,max_used,dropped\n\r"
+            "uout,%u,%u,%u,%lu\n\r", UOUT_SIZE, uout_used(), uout_stat.maxused,
+            uout_stat.dropped);
+        bench_reset();
+        dup_reset();
+        pool_reset();
+        reo_reset();
+        sfq_reset();
+        his_reset();
+        uout_reset();
+        memset(&mesh_stat, 0, sizeof(mesh_stat));
+        proceed Menu;
+
+    /*
+     * Purpose: State to prompt user for the batching delay.
+    */
+    state Aggregation:
+        uout_serf(Aggregation, "\n\rBatching delay (ms, 0 = none):");
+
+    /*
+     * Purpose: State to read the new batching delay.
+    */
+    state Get_Aggregation:
+        ser_inf(Get_Aggregation, "%u", &id);
+        aggr_delay = id;
+        proceed Menu;
+
+    /*
+     * Purpose: State to prompt user for the flood suppression parameters.
+    */
+    state Flooding:
+        uout_serf(Flooding, "\n\rCopies that cancel a rebroadcast (0 = never), rebroadcast probability (%%), max delay (ms):");
+
+    /*
+     * Purpose: State to read and validate the flood suppression parameters.
+    */
+    state Get_Flooding:
+        word k, prob, rad;
+        ser_inf(Get_Flooding, "%u %u %u", &k, &prob, &rad);
+        if (k > 255 || prob > 100) {
+            uout_serf(Get_Flooding, "\n\rInvalid parameters");
+            proceed Flooding;
+        }
+        mesh_k = (byte)k;
+        mesh_prob = (byte)prob;
+        mesh_rad = rad;
+        proceed Menu;
+
+    /*
+     * Purpose: State to prompt user for the receive queue limit.
+    */
+    state Queue_Limit:
+        uout_serf(Queue_Limit, "\n\rReceive queue limit (frames, 0 = none), drop (N)ewest/(O)ldest/by (P)riority:");
+
+    /*
+     * Purpose: State to read and apply the receive queue limit.
+    */
+    state Get_Queue_Limit:
+        word cap;
+        char policy;
+        ser_inf(Get_Queue_Limit, "%u %c", &cap, &policy);
+        policy = toupper((unsigned char)policy);
+        if ((policy != 'N' && policy != 'O' && policy != 'P') ||
+            mesh_rxlimit(sfd, cap, policy == 'O' ? MESH_RXQ_OLDEST :
+            policy == 'P' ? MESH_RXQ_PRIO : MESH_RXQ_NEWEST) != 0) {
+                uout_serf(Get_Queue_Limit, "\n\rInvalid parameters");
+                proceed Queue_Limit;
+        }
+        proceed Menu;
+
+    /*
+     * Purpose: State to prompt user for the head-of-line timeout.
+    */
+    state Ordering:
+        uout_serf(Ordering, "\n\rHold records out of order for (ms, 0 = off, e.g. %u):", REO_HOL);
+
+    /*
+     * Purpose: State to read the head-of-line timeout.
+    */
+    state Get_Ordering:
+        ser_inf(Get_Ordering, "%u", &id);
+        // Records still held are let out by the receiver
+        reo_hol = id;
+        proceed Menu;
+
+    /*
+     * Purpose: State to prompt user for a history query.
+    */
+    state History:
+        uout_serf(History, "\n\rLast n from node x (L n x), or messages since time t (S t, now %lu):",
+            his_now());
+
+    /*
+     * Purpose: State to read and start the history query.
+    */
+    state Get_History:
+        char op;
+        lword t;
+        word x;
+        ser_inf(Get_History, "%c %lu %u", &op, &t, &x);
+        op = toupper((unsigned char)op);
+        if (op == 'L' && t != 0 && t <= HIS_QMAX && x >= 1 && x <= MAX_NODE_ID) {
+            his_last(x, (word)t);
+        } else if (op == 'S') {
+            his_since(t);
+        } else {
+            uout_serf(Get_History, "\n\rInvalid parameters");
+            proceed History;
+        }
+
+    /*
+     * Purpose: State to print the header of the query's CSV lines.
+    */
+    state Hist_Head:
+        uout_serf(Hist_Head, "\n\r# hist,time,sender,seq,text\n\r");
+
+    /*
+     * Purpose: State to print the messages found, oldest first.
+    */
+    state Hist_Next:
+        if (!his_fetch(&hent))
+            proceed Menu;
+
+    /*
+     * Purpose: State to print one message found.
+    */
+    state Hist_Line:
+        uout_serf(Hist_Line, "hist,%lu,%u,%u,%s\n\r", hent.time, hent.sender,
+            hent.seq, hent.text);
+        proceed Hist_Next;
+
+    /*
+     * Purpose: State to prompt user for a multicast group operation.
+    */
+    state Groups:
+        uout_serf(Groups, "\n\rGroup (0-%u), (J)oin/(L)eave/(S)end:", MAX_GROUPS - 1);
+
+    /*
+     * Purpose: State to join or leave the group, or to send a message to it.
+    */
+    state Get_Group:
+        word g;
+        char op;
+        ser_inf(Get_Group, "%u %c", &g, &op);
+        op = toupper((unsigned char)op);
+        if (g >= MAX_GROUPS || (op != 'J' && op != 'L' && op != 'S')) {
+            uout_serf(Get_Group, "\n\rInvalid parameters");
+            proceed Groups;
+        }
+        if (op == 'J') {
+            grp_join(g);
+        } else if (op == 'L') {
+            grp_leave(g);
+        } else {
+            // One record for all members, relayed as a broadcast is
+            receiverId = ADDR_MCAST + g;
+            proceed Broadcast_Transmission;
+        }
+        proceed Menu;
+
+    /*
+     * Purpose: State to time the header line formatting.
+    */
+    state Fmt_Bench:
+        uout_serf(Fmt_Bench, "\n\rFormatting %u header lines each way...\n\r", FMT_BENCH_N);
+        fmtv = fmtf = 0;
+        fmtn = 0;
+
+    /*
+     * Purpose: State to time a batch, then let the receiver and the
+     *          plugins run before the next one.
+    */
+    state Fmt_Batch:
+        if (fmtn < FMT_BENCH_N) {
+            fmt_bench(FMT_BENCH_BATCH, &fmtv, &fmtf);
+            fmtn += FMT_BENCH_BATCH;
+            delay(0, Fmt_Batch);
+            release;
+        }
+
+    /*
+     * Purpose: State to report the formatting times (in milliseconds, per
+     *          message in nanoseconds, and in CPU cycles estimated from
+     *          the time at FMT_CPU_MHZ; nothing counts cycles).
+    */
+    state Fmt_Report:
+        uout_serf(Fmt_Report, "# fmt,count,vform_ms,fmt_ms,vform_ns,fmt_ns,vform_est_cycles,fmt_est_cycles\n\r"
+            "fmt,%u,%lu,%lu,%lu,%lu,%lu,%lu\n\r", FMT_BENCH_N, fmt_ms(fmtv), fmt_ms(fmtf),
+            fmt_ns(fmtv, FMT_BENCH_N), fmt_ns(fmtf, FMT_BENCH_N),
+            fmt_ns(fmtv, FMT_BENCH_N) * FMT_CPU_MHZ / 1000,
+            fmt_ns(fmtf, FMT_BENCH_N) * FMT_CPU_MHZ / 1000);
+        proceed Menu;
 }
@@ -0,0 +1,133 @@
+/* --------------------------------------------
+ * Purpose: Declarations shared by the modules of the P2P chat app:
+ *          the message structure, the node limits and the globals
+ *          owned by app.cc.
+ -----------------------------------------------*/
+#ifndef __app_h__
+#define __app_h__
+
+#include "sysio.h"
+
+// Set buffer size
+#define CC1350_BUF_SZ 250
+
+// Addresses are words:
+//   ADDR_BCAST                   broadcast to all nodes
+//   1 .. MAX_NODE_ID             nodes
+//   ADDR_MCAST .. + MAX_GROUPS-1 multicast groups (see grp.h)
+//   ADDR_NONE                    no address
+#define ADDR_BCAST 0x0000
+#define ADDR_MCAST 0xF000
+#define ADDR_NONE 0xFFFF
+
+// Highest valid node ID (IDs run from 1); override for larger simulated
+// cells. Per-node state is kept in fixed tables hashed on the node ID
+// (see dup.h, plug_mesh.h, rel.h, reo.h), so RAM does not grow with it.
+#ifndef MAX_NODE_ID
+#define MAX_NODE_ID 25
+#endif
+
+// Number of multicast groups
+#ifndef MAX_GROUPS
+#define MAX_GROUPS 256
+#endif
+
+#if MAX_NODE_ID >= ADDR_MCAST || MAX_GROUPS > ADDR_NONE - ADDR_MCAST
+#error "MAX_NODE_ID or MAX_GROUPS out of the address space"
+#endif
+
+// Every frame starts with the network ID word and the mesh header (see
+// plug_mesh.h) and ends with the CRC word
+#define MSG_MESH_LEN 10
+#define MSG_FRAME_HDR (2 + MSG_MESH_LEN)
+#define MSG_FRAME_OVH (MSG_FRAME_HDR + 2)
+// First record of a frame
+#define frame_recs(p) ((byte*)(p) + MSG_FRAME_HDR)
+// Header bytes in front of the payload (kind .. length)
+#define MSG_HDR_LEN 8
+// Longest payload that fits into one frame
+#define MAX_PAYLOAD (CC1350_BUF_SZ - MSG_FRAME_OVH - MSG_HDR_LEN)
+
+// Longest message the user can send; longer than MAX_PAYLOAD means it
+// goes out in fragments (see frag.h)
+#ifndef MAX_MSG_LEN
+#define MAX_MSG_LEN 2048
+#endif
+
+// Message kinds
+#define MSG_KIND_DATA 1 // complete message
+#define MSG_KIND_FRAG 2 // one fragment of a longer message
+#define MSG_KIND_ACK 3 // selective acknowledgement, see rel.h
+#define MSG_KIND_BENCH 4 // benchmark traffic, see bench.h
+
+// Flag added to the kind of a record whose receiver must acknowledge it
+#define MSG_ACKREQ 0x80
+// Flag added to the kind of an urgent record (see aggr.h)
+#define MSG_URGENT 0x40
+#define msg_kind(k) ((k) & ~(MSG_ACKREQ | MSG_URGENT))
+
+// Priority classes of outgoing messages
+#define MSG_PRIO_NORMAL 0
+#define MSG_PRIO_URGENT 1
+
+// Multicast addresses and the group they stand for
+#define addr_mcast(a) ((word)(a) >= ADDR_MCAST && (word)(a) != ADDR_NONE)
+#define addr_group(a) ((word)(a) - ADDR_MCAST)
+// Broadcast, a node or an existing group
+#define addr_valid(a) ((word)(a) <= MAX_NODE_ID || \
+    (addr_mcast(a) && addr_group(a) < MAX_GROUPS))
+
+// Group membership of this node, one bit per group (see grp.h)
+extern byte grp_bits [];
+#define grp_member(g) ((word)(g) < MAX_GROUPS && \
+    (grp_bits [(word)(g) >> 3] & (1 << ((g) & 7))))
+
+// A record is for this node if addressed to it, broadcast, or multicast
+// to a group it belongs to
+#define msg_unicast(r) ((r) != ADDR_BCAST && !addr_mcast(r))
+#define msg_for_me(r) ((r) == nodeId || (r) == ADDR_BCAST || \
+    (addr_mcast(r) && grp_member(addr_group(r))))
+
+// Records are packed back to back, so word fields on the air are kept
+// as big-endian byte pairs
+#define msg_getw(a) ((word)(((word)(byte)(a) [0] << 8) | (byte)(a) [1]))
+#define msg_putw(a, w) do { (a) [0] = (byte)((w) >> 8); \
+    (a) [1] = (byte)(w); } while (0)
+
+// A. Message Structure: the header as it goes on the air, followed by
+// the used part of the payload
+struct msg {
+    byte kind; // 1 byte
+    byte senderId [2]; // 2 bytes, msg_getw/msg_putw
+    byte receiverId [2]; // 2 bytes, msg_getw/msg_putw
+    byte sequenceNumber [2]; // 2 bytes, msg_getw/msg_putw
+    byte length; // 1 byte, payload bytes used
+    char payload[]; // up to MAX_PAYLOAD bytes
+};
+
+// Result of sending a message
+#define MSG_RES_SENT 0 // sent, not acknowledged
+#define MSG_RES_DELIVERED 1 // acknowledged by the receiver
+#define MSG_RES_FAILED 2 // never acknowledged
+#define MSG_RES_REJECTED 3 // not sent (invalid, see hlink.h)
+#define MSG_RES_QUEUED 4 // never acknowledged, kept in the flash (see sfq.h)
+
+// Message as entered by the user
+struct outmsg {
+    word receiverId;
+    byte kind; // MSG_KIND_DATA, or MSG_KIND_BENCH for bench_tx
+    byte prio; // MSG_PRIO_*
+    byte result; // MSG_RES_*, set by send
+    word length;
+    char text[MAX_MSG_LEN + 1]; // + NUL
+};
+
+// Sends a message (app.cc)
+fsm send (struct outmsg*);
+
+// Globals defined in app.cc
+extern word nodeId;
+extern word sequence;
+extern int sfd;
+
+#endif
@@ -0,0 +1,155 @@
+/* --------------------------------------------
+ * Purpose: Synthetic traffic for the send/receive path (see bench.h).
+ *          Latency is the difference between the sender's timestamp,
+ *          taken when the message is queued, and the receiver's clock
+ *          when the message reaches Show_Message, so it is only
+ *          meaningful when the node clocks start together (as under VUEE).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "serf.h"
+#include "tcv.h"
+#include "app.h"
+#include "bench.h"
+#include "mstime.h"
+#include "uout.h"
+
+benchpar_t bench_par;
+benchstat_t bench_stat;
+
+#if BENCH_SENDERS & (BENCH_SENDERS - 1)
+#error "BENCH_SENDERS must be a power of two"
+#endif
+
+// Next expected bench sequence number per sender, hashed on the node ID
+typedef struct {
+    word next;
+    word sender; // 0 = entry free
+} benchsnd_t;
+
+static benchsnd_t bench_next [BENCH_SENDERS];
+
+void bench_init () {
+    bench_reset();
+}
+
+Boolean bench_valid (const benchpar_t *par) {
+    if (!addr_valid(par->receiverId) || par->count == 0)
+        return NO;
+    if (par->mode != BENCH_FIXED && par->mode != BENCH_BURSTY &&
+        par->mode != BENCH_SATURATE)
+            return NO;
+    return par->length >= BENCH_HDR_LEN &&
+        par->length <= MAX_PAYLOAD;
+}
+
+/*
+ * Purpose: Compose a benchmark payload of the given length for bench
+ *          sequence number seq. Returns the length.
+*/
+word bench_fill (char *p, word len, word seq) {
+    lword t = mstime();
+    word i;
+
+    p[0] = (char)(t >> 24); p[1] = (char)(t >> 16);
+    p[2] = (char)(t >> 8); p[3] = (char)t;
+    p[4] = (char)(seq >> 8); p[5] = (char)seq;
+    for (i = BENCH_HDR_LEN; i < len; i++)
+        p[i] = 'x';
+    return len;
+}
+
+/*
+ * Purpose: Account for a received benchmark message. Returns NO if the
+ *          payload is too short, otherwise its sequence number and latency.
+*/
+Boolean bench_rx (word sender, const char *p, word len, word *seq, word *lat) {
+    benchsnd_t *b = bench_next + ((sender * 7) & (BENCH_SENDERS - 1));
+    lword now, t;
+
+    if (len < BENCH_HDR_LEN)
+        return NO;
+
+    now = mstime();
+    t = ((lword)(byte)p[0] << 24) | ((lword)(byte)p[1] << 16) |
+        ((lword)(byte)p[2] << 8) | (byte)p[3];
+    *seq = ((word)(byte)p[4] << 8) | (byte)p[5];
+    *lat = (word)(now - t);
+
+    // Count gaps in the sender's sequence as losses
+    if (b->sender != sender) {
+        // One taking another sender's entry is counted from here on
+        b->next = b->sender == 0 ? 0 : *seq;
+        b->sender = sender;
+    }
+    if (*seq > b->next)
+        bench_stat.lost += *seq - b->next;
+    b->next = *seq + 1;
+
+    if (bench_stat.received == 0) {
+        bench_stat.first = now;
+        bench_stat.latmin = bench_stat.latmax = *lat;
+    }
+    bench_stat.received++;
+    bench_stat.last = now;
+    bench_stat.latsum += *lat;
+    if (*lat < bench_stat.latmin)
+        bench_stat.latmin = *lat;
+    if (*lat > bench_stat.latmax)
+        bench_stat.latmax = *lat;
+    return YES;
+}
+
+void bench_reset () {
+    memset(&bench_stat, 0, sizeof(bench_stat));
+    memset(bench_next, 0, sizeof(bench_next));
+}
+
+/*
+ * Purpose: Drive the send path with synthetic traffic as described by par.
+*/
+fsm bench_tx (benchpar_t *par) {
+    word sent;
+    word inburst;
+    word maxq;
+    lword start;
+    struct outmsg * m;
+
+    state BT_Start:
+        uout_serf(BT_Start, "\n\r# tx,receiver,mode,sent,elapsed_ms,msgs_per_s,max_qsize\n\r");
+        sent = inburst = maxq = 0;
+        start = mstime();
+        m = par->out;
+        m->kind = MSG_KIND_BENCH;
+        m->receiverId = par->receiverId;
+
+    state BT_Send:
+        if (sent == par->count)
+            proceed BT_Done;
+        m->length = bench_fill(m->text, par->length, sent);
+        sent++;
+        call send(m, BT_Sent);
+
+    state BT_Sent:
+        word q = tcv_qsize(sfd, TCV_DSP_XMT);
+        if (q > maxq)
+            maxq = q;
+
+        if (par->mode == BENCH_SATURATE)
+            proceed BT_Send;
+        if (par->mode == BENCH_BURSTY) {
+            if (++inburst < BENCH_BURST)
+                proceed BT_Send;
+            inburst = 0;
+            delay(par->interval * BENCH_BURST, BT_Send);
+            release;
+        }
+        delay(par->interval, BT_Send);
+        release;
+
+    state BT_Done:
+        lword elapsed = mstime() - start;
+        uout_serf(BT_Done, "tx,%u,%c,%u,%lu,%lu,%u\n\r", par->receiverId,
+            par->mode, sent, elapsed,
+            elapsed ? (lword)sent * 1000 / elapsed : 0, maxq);
+        finish;
+}
@@ -0,0 +1,59 @@
+/* --------------------------------------------
+ * Purpose: Traffic generator and measurement hooks for benchmarking the
+ *          send/receive path. The messages go through send like typed
+ *          ones, as records of their own kind (MSG_KIND_BENCH). Results
+ *          are printed over the serial line as CSV records:
+ *            rx,<sender>,<bench seq>,<latency ms>
+ *            tx,<receiver>,<mode>,<sent>,<elapsed ms>,<msgs/s>,<max queue>
+ *            rxsum,<received>,<lost>,<elapsed ms>,<msgs/s>,<lat min>,<lat avg>,<lat max>
+ -----------------------------------------------*/
+#ifndef __bench_h__
+#define __bench_h__
+
+#include "sysio.h"
+#include "app.h"
+
+// Traffic modes
+#define BENCH_FIXED 'F' // one message every interval
+#define BENCH_BURSTY 'B' // BENCH_BURST back-to-back, same average rate
+#define BENCH_SATURATE 'S' // as fast as the TCV queue accepts them
+
+#define BENCH_BURST 8
+
+// Timestamp (lword) + bench sequence number (word)
+#define BENCH_HDR_LEN 6
+
+// Senders whose losses are counted at once (a power of two); a sender
+// whose entry is taken by another one is counted afresh
+#ifndef BENCH_SENDERS
+#define BENCH_SENDERS 16
+#endif
+
+typedef struct {
+    word receiverId; // ADDR_BCAST, a node or a group
+    char mode;
+    word count;
+    word interval; // msec
+    word length; // payload bytes
+    struct outmsg *out; // message buffer; its prio is kept
+} benchpar_t;
+
+typedef struct {
+    word received, lost;
+    lword first, last; // arrival times of first and last message
+    lword latsum;
+    word latmin, latmax;
+} benchstat_t;
+
+extern benchpar_t bench_par;
+extern benchstat_t bench_stat;
+
+void bench_init (void);
+Boolean bench_valid (const benchpar_t*);
+word bench_fill (char*, word, word);
+Boolean bench_rx (word, const char*, word, word*, word*);
+void bench_reset (void);
+
+fsm bench_tx (benchpar_t*);
+
+#endif
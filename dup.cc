@@ -0,0 +1,73 @@
+/* --------------------------------------------
+ * Purpose: Duplicate suppression (see dup.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "app.h"
+#include "dup.h"
+
+#if DUP_SLOTS & (DUP_SLOTS - 1)
+#error "DUP_SLOTS must be a power of two"
+#endif
+
+typedef struct {
+    lword bits; // bit i set = number last - 1 - i received
+    word last;
+    word when; // seconds() of the last record
+    word sender; // 0 = entry free
+} dupent_t;
+
+static dupent_t dup_tab [DUP_SLOTS];
+
+dupstat_t dup_stat;
+
+/*
+ * Purpose: Return YES if the record seq from sender has been seen
+ *          before, otherwise remember it and return NO.
+*/
+Boolean dup_check (word sender, word seq) {
+    dupent_t *e = dup_tab + ((sender * 7) & (DUP_SLOTS - 1));
+    word now = (word)seconds();
+    word d;
+
+    if (e->sender != sender || (word)(now - e->when) >= DUP_STALE) {
+        if (e->sender != 0 && e->sender != sender)
+            dup_stat.evictions++;
+        e->sender = sender;
+        e->last = seq;
+        e->bits = 0;
+        e->when = now;
+        dup_stat.misses++;
+        return NO;
+    }
+    e->when = now;
+
+    d = seq - e->last;
+    if (d != 0 && d < 0x8000) {
+        // Newer than anything so far: slide the window
+        e->bits = d > DUP_WINDOW ? 0 : ((e->bits << 1) | 1) << (d - 1);
+        e->last = seq;
+        dup_stat.misses++;
+        return NO;
+    }
+
+    d = e->last - seq;
+    if (d == 0 || (d <= DUP_WINDOW && (e->bits & ((lword)1 << (d - 1))))) {
+        dup_stat.hits++;
+        return YES;
+    }
+
+    if (d <= DUP_WINDOW) {
+        // Late but new (e.g., reordered)
+        e->bits |= (lword)1 << (d - 1);
+    } else {
+        // Far behind: the sender has restarted its numbering
+        e->last = seq;
+        e->bits = 0;
+    }
+    dup_stat.misses++;
+    return NO;
+}
+
+void dup_reset () {
+    memset(&dup_stat, 0, sizeof(dup_stat));
+}
@@ -0,0 +1,42 @@
+/* --------------------------------------------
+ * Purpose: Duplicate suppression. For every sender, the highest
+ *          sequence number received and a bitmap of the DUP_WINDOW
+ *          numbers before it are kept, so retransmissions and multipath
+ *          copies are recognized before they are shown.
+ *
+ *          The table has a fixed number of entries, hashed on the sender
+ *          ID, so its size does not depend on how many nodes there are. A
+ *          sender that finds its entry taken by another one evicts it;
+ *          the evicted sender's history is lost, which can only let a
+ *          duplicate through. An entry not used for DUP_STALE seconds is
+ *          forgotten as well. A node numbers its records from a random
+ *          start after every boot, so a sender that has rebooted is
+ *          unlikely to hit the window of its old numbers.
+ -----------------------------------------------*/
+#ifndef __dup_h__
+#define __dup_h__
+
+#include "sysio.h"
+#include "app.h"
+
+// Table entries (a power of two)
+#ifndef DUP_SLOTS
+#define DUP_SLOTS 32
+#endif
+
+// Sequence numbers remembered before the highest one (bits in an lword)
+#define DUP_WINDOW 32
+
+// Entries not used for this long are forgotten (sec)
+#define DUP_STALE 60
+
+typedef struct {
+    lword hits, misses, evictions;
+} dupstat_t;
+
+extern dupstat_t dup_stat;
+
+Boolean dup_check (word, word);
+void dup_reset (void);
+
+#endif
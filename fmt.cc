@@ -0,0 +1,97 @@
+/* --------------------------------------------
+ * Purpose: Straight-line formatting (see fmt.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "form.h"
+#include "app.h"
+#include "rcv.h"
+#include "mstime.h"
+#include "fmt.h"
+
+// Output of fmt_bench; outside the function, so that the compiler cannot
+// drop the formatting as unused
+static char fmt_buf [FMT_SHOW_MAX + 1];
+
+char *fmt_s (char *p, const char *s) {
+    while (*s != '\0')
+        *p++ = *s++;
+    return p;
+}
+
+char *fmt_u (char *p, word v) {
+    char d [5];
+    byte n = 0;
+
+    do {
+        d [n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    while (n)
+        *p++ = d [--n];
+    return p;
+}
+
+/*
+ * Purpose: Write the header line of the message seen through v (FMT_SHOW)
+ *          into b. Returns its length.
+*/
+word fmt_show (char *b, const msgview_t *v) {
+    char *p = b;
+
+    if (v->kind & MSG_URGENT)
+        p = fmt_s(p, "URGENT ");
+    p = fmt_s(p, v->receiverId == nodeId ? "Message " :
+        addr_mcast(v->receiverId) ? "Group " : "Broadcast ");
+    p = fmt_s(p, "Message from node ");
+    p = fmt_u(p, v->senderId);
+    p = fmt_s(p, " (Seq ");
+    p = fmt_u(p, v->sequenceNumber);
+    p = fmt_s(p, "): ");
+    return (word)(p - b);
+}
+
+/*
+ * Purpose: Write the CSV line of a received benchmark message
+ *          ("rx,%u,%u,%u\n\r") into b. Returns its length.
+*/
+word fmt_rx (char *b, word sender, word seq, word lat) {
+    char *p = b;
+
+    p = fmt_s(p, "rx,");
+    p = fmt_u(p, sender);
+    *p++ = ',';
+    p = fmt_u(p, seq);
+    *p++ = ',';
+    p = fmt_u(p, lat);
+    p = fmt_s(p, "\n\r");
+    return (word)(p - b);
+}
+
+/*
+ * Purpose: Format the header line of a sample message n times with form
+ *          (vform, as ser_outf does) and n times with fmt_show; add the
+ *          msec (1/1024 s) taken to *tv and *tf.
+*/
+void fmt_bench (word n, lword *tv, lword *tf) {
+    msgview_t v;
+    lword t;
+    word i;
+
+    v.kind = MSG_KIND_DATA;
+    v.senderId = 12;
+    v.receiverId = nodeId;
+    v.sequenceNumber = 34567;
+
+    t = mstime();
+    for (i = 0; i < n; i++)
+        form(fmt_buf, FMT_SHOW, (v.kind & MSG_URGENT) ? "URGENT " : "",
+            v.receiverId == nodeId ? "Message " :
+                addr_mcast(v.receiverId) ? "Group " : "Broadcast ",
+            v.senderId, v.sequenceNumber);
+    *tv += mstime() - t;
+
+    t = mstime();
+    for (i = 0; i < n; i++)
+        fmt_show(fmt_buf, &v);
+    *tf += mstime() - t;
+}
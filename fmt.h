@@ -0,0 +1,48 @@
+/* --------------------------------------------
+ * Purpose: Straight-line formatting of the lines printed for every
+ *          received message. Where ser_outf and vform parse the format
+ *          string character by character on every call, these functions
+ *          are the format already taken apart: fmt_s and fmt_u append
+ *          one item each and return the new end of the line, and a line
+ *          is built by chaining them in the order of its format.
+ *
+ *          FMT_SHOW is the format that fmt_show implements, kept here
+ *          for fmt_bench, which times the two against each other.
+ -----------------------------------------------*/
+#ifndef __fmt_h__
+#define __fmt_h__
+
+#include "sysio.h"
+#include "app.h"
+#include "rcv.h"
+
+// Header line of a received message
+#define FMT_SHOW "%s%sMessage from node %u (Seq %u): "
+// Longest such line
+#define FMT_SHOW_MAX 64
+
+// Lines formatted each way by the microbenchmark, in batches between
+// which the CPU is released (each one takes a few msec)
+#define FMT_BENCH_N 2000
+#define FMT_BENCH_BATCH 250
+
+#if FMT_BENCH_N % FMT_BENCH_BATCH
+#error "FMT_BENCH_N must be a multiple of FMT_BENCH_BATCH"
+#endif
+
+// PicOS msec (1/1024 s) t in milliseconds, and per line of n in ns
+#define fmt_ms(t) ((t) * 1000 / 1024)
+#define fmt_ns(t, n) ((t) * 1000000 / (n) * 1000 / 1024)
+
+// CPU clock, for estimating cycles from times
+#ifndef FMT_CPU_MHZ
+#define FMT_CPU_MHZ 48
+#endif
+
+char *fmt_s (char*, const char*);
+char *fmt_u (char*, word);
+word fmt_show (char*, const msgview_t*);
+word fmt_rx (char*, word, word, word);
+void fmt_bench (word, lword*, lword*);
+
+#endif
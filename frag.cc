@@ -0,0 +1,162 @@
+/* --------------------------------------------
+ * Purpose: Fragmentation and reassembly (see frag.h). A sender may have
+ *          one message in reassembly at a time; a new message ID from
+ *          the same sender replaces the partial one.
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "app.h"
+#include "pool.h"
+#include "frag.h"
+
+#if FRAG_DATA > POOL_BUF_SZ
+#error "A fragment does not fit in a pool buffer"
+#endif
+
+// Otherwise concurrent reassemblies can starve each other of buffers
+// until all of them time out
+#if POOL_BUFS < FRAG_SLOTS * FRAG_MAX
+#error "POOL_BUFS must hold FRAG_SLOTS messages of MAX_MSG_LEN"
+#endif
+
+static fragmsg_t frag_slots [FRAG_SLOTS];
+
+static void frag_release (fragmsg_t *s) {
+    byte i;
+
+    for (i = 0; i < s->count; i++) {
+        if (s->blk [i] != NULL) {
+            pool_put(s->blk [i]);
+            s->blk [i] = NULL;
+        }
+    }
+    s->busy = s->done = NO;
+}
+
+/*
+ * Purpose: Discard the partial messages that have had no fragment for
+ *          FRAG_TIMEOUT seconds, returning their buffers to the pool.
+*/
+void frag_expire (void) {
+    lword now = seconds();
+    fragmsg_t *t;
+
+    for (t = frag_slots; t < frag_slots + FRAG_SLOTS; t++)
+        // A complete message is the caller's until frag_free
+        if (t->busy && !t->done && now - t->last > FRAG_TIMEOUT)
+            frag_release(t);
+}
+
+/*
+ * Purpose: Write fragment idx of message m (message ID id) into payload
+ *          area p. Returns the payload length.
+*/
+word frag_put (char *p, const struct outmsg *m, byte id, byte idx) {
+    word off = idx * FRAG_DATA;
+    word len = m->length - off;
+
+    if (len > FRAG_DATA)
+        len = FRAG_DATA;
+    p[0] = id;
+    p[1] = idx;
+    p[2] = (byte)frag_count(m->length);
+    p[3] = (byte)(m->length >> 8);
+    p[4] = (byte)m->length;
+    memcpy(p + FRAG_HDR_LEN, m->text + off, len);
+    return len + FRAG_HDR_LEN;
+}
+
+/*
+ * Purpose: Absorb a fragment from sender. When it completes a message,
+ *          returns the message (to be read with frag_text and freed with
+ *          frag_free) and its length in *total, otherwise NULL.
+*/
+fragmsg_t *frag_rx (word sender, const char *p, byte len, word *total) {
+    fragmsg_t *s, *empty;
+    byte id, idx, count;
+    word tot, off;
+    lword now;
+    int i;
+
+    if (len <= FRAG_HDR_LEN)
+        return NULL;
+    id = p[0];
+    idx = p[1];
+    count = p[2];
+    tot = ((word)(byte)p[3] << 8) | (byte)p[4];
+    len -= FRAG_HDR_LEN;
+    off = idx * FRAG_DATA;
+
+    // Reject malformed fragments and messages we have no room for; every
+    // fragment must fill its part of the message exactly
+    if (tot == 0 || tot > MAX_MSG_LEN || count != frag_count(tot) ||
+        idx >= count || len + FRAG_HDR_LEN != frag_size(tot, idx))
+            return NULL;
+
+    frag_expire();
+    now = seconds();
+    s = empty = NULL;
+    for (i = 0; i < FRAG_SLOTS; i++) {
+        fragmsg_t *t = frag_slots + i;
+        if (t->done)
+            continue;
+        if (!t->busy) {
+            if (empty == NULL)
+                empty = t;
+        } else if (t->sender == sender) {
+            s = t;
+        }
+    }
+
+    if (s != NULL && (s->id != id || s->total != tot)) {
+        // The sender has moved on to another message
+        frag_release(s);
+        empty = s;
+        s = NULL;
+    }
+
+    if (s == NULL) {
+        if (empty == NULL)
+            // All slots busy: drop, the sender will time out or retry
+            return NULL;
+        s = empty;
+        s->busy = YES;
+        s->sender = sender;
+        s->id = id;
+        s->count = count;
+        s->total = tot;
+        s->have = 0;
+    }
+
+    s->last = now;
+    if (s->blk [idx] == NULL) {
+        // Out of buffers: drop the fragment, it will be sent again
+        if ((s->blk [idx] = pool_get()) == NULL)
+            return NULL;
+        memcpy(s->blk [idx], p + FRAG_HDR_LEN, len);
+        s->have |= (lword)1 << idx;
+    }
+    if (s->have != ((lword)1 << (count - 1)) * 2 - 1)
+        return NULL;
+
+    // Complete: hand the message over to the caller
+    s->done = YES;
+    *total = tot;
+    return s;
+}
+
+/*
+ * Purpose: Return the longest contiguous piece of message m starting at
+ *          byte off; *len is reduced to its length.
+*/
+const char *frag_text (const fragmsg_t *m, word off, word *len) {
+    word n = FRAG_DATA - off % FRAG_DATA;
+
+    if (*len > n)
+        *len = n;
+    return m->blk [off / FRAG_DATA] + off % FRAG_DATA;
+}
+
+void frag_free (fragmsg_t *m) {
+    frag_release(m);
+    frag_expire();
+}
@@ -0,0 +1,65 @@
+/* --------------------------------------------
+ * Purpose: Fragmentation of messages longer than one frame and their
+ *          reassembly on the receiving side.
+ *
+ *          Every fragment is a MSG_KIND_FRAG frame whose payload starts
+ *          with a FRAG_HDR_LEN byte subheader:
+ *            message ID, fragment index, fragment count, total length (word)
+ *          followed by up to FRAG_DATA bytes of the message.
+ *
+ *          The receiver keeps every fragment in a buffer of its own from
+ *          the pool (see pool.h), so a message is never copied into one
+ *          large block; frag_text hands it out piece by piece.
+ -----------------------------------------------*/
+#ifndef __frag_h__
+#define __frag_h__
+
+#include "sysio.h"
+#include "app.h"
+
+#define FRAG_HDR_LEN 5
+#define FRAG_DATA (MAX_PAYLOAD - FRAG_HDR_LEN)
+
+// Messages being reassembled at the same time
+#ifndef FRAG_SLOTS
+#define FRAG_SLOTS 2
+#endif
+
+// Seconds after the last fragment before a partial message is discarded
+// (by frag_expire, which the receiver calls for every packet)
+#ifndef FRAG_TIMEOUT
+#define FRAG_TIMEOUT 10
+#endif
+
+// The fragment bitmap is an lword
+#if (MAX_MSG_LEN + FRAG_DATA - 1) / FRAG_DATA > 32
+#error "MAX_MSG_LEN needs more than 32 fragments"
+#endif
+
+#define frag_count(len) (((len) + FRAG_DATA - 1) / FRAG_DATA)
+
+// Most fragments in a message
+#define FRAG_MAX frag_count(MAX_MSG_LEN)
+
+// Payload length of fragment idx of a message of len bytes
+#define frag_size(len, idx) (FRAG_HDR_LEN + \
+    ((idx) < frag_count(len) - 1 ? FRAG_DATA : (len) - (idx) * FRAG_DATA))
+
+// A message in reassembly; handed to the caller once complete
+typedef struct {
+    char *blk [FRAG_MAX]; // pool buffers of the fragments received
+    lword last; // seconds() at the last fragment
+    lword have; // bitmap of received fragments
+    word total;
+    word sender;
+    byte id, count;
+    Boolean busy, done;
+} fragmsg_t;
+
+word frag_put (char*, const struct outmsg*, byte, byte);
+fragmsg_t *frag_rx (word, const char*, byte, word*);
+const char *frag_text (const fragmsg_t*, word, word*);
+void frag_free (fragmsg_t*);
+void frag_expire (void);
+
+#endif
@@ -0,0 +1,32 @@
+/* --------------------------------------------
+ * Purpose: Multicast group membership (see grp.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "app.h"
+#include "grp.h"
+
+byte grp_bits [(MAX_GROUPS + 7) / 8];
+word grp_joined;
+
+/*
+ * Purpose: Join group g. Returns NO if there is no such group.
+*/
+Boolean grp_join (word g) {
+    if (g >= MAX_GROUPS)
+        return NO;
+    if (!grp_member(g)) {
+        grp_bits [g >> 3] |= 1 << (g & 7);
+        grp_joined++;
+    }
+    return YES;
+}
+
+Boolean grp_leave (word g) {
+    if (g >= MAX_GROUPS)
+        return NO;
+    if (grp_member(g)) {
+        grp_bits [g >> 3] &= ~(1 << (g & 7));
+        grp_joined--;
+    }
+    return YES;
+}
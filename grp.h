@@ -0,0 +1,23 @@
+/* --------------------------------------------
+ * Purpose: Multicast group membership. A record sent to group address
+ *          ADDR_MCAST + g is for the nodes that have joined group g.
+ *          Membership is one bit per group (grp_bits, see app.h), so
+ *          checking a record's receiver costs the same whatever the
+ *          number of groups and members. The mesh plugin drops frames
+ *          without a record for this node before they are queued, so a
+ *          group message costs non-members nothing beyond relaying it,
+ *          and one flooded frame reaches every member.
+ -----------------------------------------------*/
+#ifndef __grp_h__
+#define __grp_h__
+
+#include "sysio.h"
+#include "app.h"
+
+// Number of groups joined
+extern word grp_joined;
+
+Boolean grp_join (word);
+Boolean grp_leave (word);
+
+#endif
@@ -0,0 +1,493 @@
+/* --------------------------------------------
+ * Purpose: History of received messages in the SPI flash (see his.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "storage.h"
+#include "app.h"
+#include "rcv.h"
+#include "sfq.h"
+#include "his.h"
+
+#if HIS_SECTORS < 3
+#error "HIS_SECTORS must be at least 3"
+#endif
+
+#if HIS_SHDR + HIS_EHDR + HIS_TEXT >= HIS_PAGE || HIS_TEXT >= HIS_FREE
+#error "HIS_TEXT is too long"
+#endif
+
+#if HIS_FROM & (HIS_FROM - 1) || HIS_FROM < 8
+#error "HIS_FROM must be a power of two, at least 8"
+#endif
+
+// Bit of sender n in a sector's summary
+#define his_bit(n) (((n) * 7) & (HIS_FROM - 1))
+#define his_has(s, n) (his_sec [s].from [his_bit(n) >> 3] & (1 << (his_bit(n) & 7)))
+#define his_note(s, n) (his_sec [s].from [his_bit(n) >> 3] |= 1 << (his_bit(n) & 7))
+
+typedef struct {
+    lword t0; // time of the first entry
+    word serial;
+    byte from [HIS_FROM / 8]; // senders with entries here, hashed
+    Boolean valid, any; // has a header, has entries
+} hissec_t;
+
+static hissec_t his_sec [HIS_SECTORS];
+
+// Page buffers: flash address of the page, bytes staged up to end, of
+// which those from from on are not programmed yet
+static byte his_buf [2][HIS_PAGE];
+static lword his_adr [2];
+static word his_from [2], his_end [2];
+static Boolean his_full [2];
+
+// Buffer being filled, address of the next byte, sector being filled
+static byte his_cur;
+static lword his_tail;
+static word his_sn, his_serial;
+
+// The sector after his_sn is erased; the sector to erase, if any
+static Boolean his_spare;
+static int his_erase = NONE;
+
+static Boolean his_ready;
+static lword his_epoch;
+
+// Query: his_last results, or the his_since position and time
+static lword his_q [HIS_QMAX];
+static byte his_qi, his_qn;
+static Boolean his_qsince;
+static lword his_qa, his_qt;
+
+hisstat_t his_stat;
+
+#define HIS_EV_WORK ((aword)his_buf)
+
+#define his_start(s) (HIS_BASE + (lword)(s) * HIS_SECTOR)
+#define his_after(s) (((s) + 1) % HIS_SECTORS)
+// Sector of the entry ending at (or starting just before) a
+#define his_sect(a) ((word)(((a) - 1 - HIS_BASE) / HIS_SECTOR))
+
+#define his_getl(a) (((lword)msg_getw(a) << 16) | msg_getw((a) + 2))
+#define his_putl(a, l) do { msg_putw(a, (word)((l) >> 16)); \
+    msg_putw((a) + 2, (word)(l)); } while (0)
+
+lword his_now (void) {
+    return his_epoch + seconds();
+}
+
+/*
+ * Purpose: Start filling the current buffer at flash address a.
+*/
+static void his_page (lword a) {
+    his_adr [his_cur] = a & ~(lword)(HIS_PAGE - 1);
+    his_from [his_cur] = his_end [his_cur] = (word)(a & (HIS_PAGE - 1));
+    memset(his_buf [his_cur], 0xFF, HIS_PAGE);
+}
+
+/*
+ * Purpose: Stage n bytes, moving to the other buffer at the end of a page.
+*/
+static void his_stage (const byte *p, word n) {
+    word off, k;
+
+    while (n) {
+        off = (word)(his_tail & (HIS_PAGE - 1));
+        k = HIS_PAGE - off;
+        if (k > n)
+            k = n;
+        memcpy(his_buf [his_cur] + off, p, k);
+        his_tail += k;
+        his_end [his_cur] = off + k;
+        p += k;
+        n -= k;
+        if ((his_tail & (HIS_PAGE - 1)) == 0) {
+            his_full [his_cur] = YES;
+            his_cur ^= 1;
+            his_page(his_tail);
+            trigger(HIS_EV_WORK);
+        }
+    }
+}
+
+/*
+ * Purpose: Start filling sector s, which is erased.
+*/
+static void his_open (word s) {
+    byte h [HIS_SHDR];
+
+    his_sn = s;
+    his_serial++;
+    his_tail = his_start(s);
+    his_page(his_tail);
+    msg_putw(h, HIS_MAGIC);
+    msg_putw(h + 2, his_serial);
+    his_stage(h, HIS_SHDR);
+    his_sec [s].serial = his_serial;
+    his_sec [s].valid = YES;
+    his_sec [s].any = NO;
+    memset(his_sec [s].from, 0, sizeof(his_sec [s].from));
+}
+
+/*
+ * Purpose: Read n bytes from the log, including those still in RAM.
+*/
+static void his_read (lword a, byte *p, word n) {
+    lword lo, hi;
+    byte b;
+
+    ee_read(a, p, n);
+    for (b = 0; b < 2; b++) {
+        lo = his_adr [b] + his_from [b];
+        hi = his_adr [b] + his_end [b];
+        if (lo < a)
+            lo = a;
+        if (hi > a + n)
+            hi = a + n;
+        if (lo < hi)
+            memcpy(p + (lo - a), his_buf [b] + (lo - his_adr [b]), (word)(hi - lo));
+    }
+}
+
+/*
+ * Purpose: Read the header of the entry at a; NO at the end of its sector.
+*/
+static Boolean his_hdr (lword a, byte *h) {
+    if (a + HIS_EHDR > his_start(his_sect(a)) + HIS_SECTOR ||
+        (his_sect(a) == his_sn && a >= his_tail))
+            return NO;
+    his_read(a, h, HIS_EHDR);
+    return h [0] <= HIS_TEXT;
+}
+
+/*
+ * Purpose: Append the message seen through v, with n bytes of text t.
+ *          Returns NO if it is left out.
+*/
+Boolean his_add (const msgview_t *v, const char *t, word n) {
+    byte h [HIS_EHDR];
+    lword now = his_now();
+    hissec_t *s;
+    word need;
+
+    if (!his_ready) {
+        his_stat.dropped++;
+        return NO;
+    }
+    if (n > HIS_TEXT)
+        n = HIS_TEXT;
+    need = HIS_EHDR + n;
+
+    if (his_tail + need > his_start(his_sn) + HIS_SECTOR) {
+        // On to the next sector, once it is erased
+        if (!his_spare || his_full [his_cur ^ 1]) {
+            his_stat.dropped++;
+            return NO;
+        }
+        if (his_end [his_cur] != his_from [his_cur]) {
+            his_full [his_cur] = YES;
+            his_cur ^= 1;
+        }
+        his_open(his_after(his_sn));
+        // Queries leave the oldest sector alone from now on
+        his_spare = NO;
+        his_erase = his_after(his_sn);
+        his_sec [his_erase].valid = NO;
+        trigger(HIS_EV_WORK);
+    }
+
+    if (need >= HIS_PAGE - (word)(his_tail & (HIS_PAGE - 1)) &&
+        his_full [his_cur ^ 1]) {
+            his_stat.dropped++;
+            return NO;
+    }
+
+    h [0] = (byte)n;
+    msg_putw(h + 1, v->senderId);
+    msg_putw(h + 3, v->sequenceNumber);
+    his_putl(h + 5, now);
+    his_stage(h, HIS_EHDR);
+    his_stage((const byte*)t, n);
+
+    s = his_sec + his_sn;
+    if (!s->any) {
+        s->any = YES;
+        s->t0 = now;
+    }
+    his_note(his_sn, v->senderId);
+    his_stat.stored++;
+    return YES;
+}
+
+/*
+ * Purpose: Find the newest sector, summarize every sector and continue
+ *          the log after the last entry. Returns NO if there is no log.
+*/
+static Boolean his_scan (void) {
+    byte h [HIS_EHDR];
+    word s, i, last = 0;
+    Boolean found = NO;
+    lword a, t = 0;
+
+    for (s = 0; s < HIS_SECTORS; s++) {
+        ee_read(his_start(s), h, HIS_SHDR);
+        if (msg_getw(h) != HIS_MAGIC)
+            continue;
+        his_sec [s].valid = YES;
+        his_sec [s].serial = msg_getw(h + 2);
+        if (!found || (wint)(his_sec [s].serial - his_serial) > 0) {
+            found = YES;
+            last = s;
+            his_serial = his_sec [s].serial;
+        }
+    }
+    if (!found)
+        return NO;
+    his_sn = last;
+
+    for (i = 1; i <= HIS_SECTORS; i++) {
+        s = (last + i) % HIS_SECTORS;
+        if (!his_sec [s].valid)
+            continue;
+        a = his_start(s) + HIS_SHDR;
+        while (a + HIS_EHDR <= his_start(s) + HIS_SECTOR) {
+            ee_read(a, h, HIS_EHDR);
+            if (h [0] == HIS_FREE)
+                break;
+            if (h [0] > HIS_TEXT || a + HIS_EHDR + h [0] > his_start(s) + HIS_SECTOR) {
+                // Cut short by a reset: nothing more is appended here
+                a = his_start(s) + HIS_SECTOR;
+                break;
+            }
+            t = his_getl(h + 5);
+            if (!his_sec [s].any) {
+                his_sec [s].any = YES;
+                his_sec [s].t0 = t;
+            }
+            his_note(s, msg_getw(h + 1));
+            a += HIS_EHDR + h [0];
+        }
+        if (s == last)
+            his_tail = a;
+    }
+    // Times carry on from the last entry
+    his_epoch = t + 1;
+    his_page(his_tail);
+    return YES;
+}
+
+/*
+ * Purpose: Return YES if sector s is erased throughout; an erase cut
+ *          short by a reset may leave its start erased but not the rest.
+*/
+static Boolean his_blank (word s) {
+    byte h [32];
+    lword a;
+    word i;
+
+    for (a = his_start(s); a < his_start(s) + HIS_SECTOR; a += sizeof(h)) {
+        ee_read(a, h, sizeof(h));
+        for (i = 0; i < sizeof(h); i++)
+            if (h [i] != 0xFF)
+                return NO;
+    }
+    return YES;
+}
+
+/*
+ * Purpose: Recover the log, then program the page buffers and erase the
+ *          sectors ahead of the writer as his_add asks for it.
+*/
+fsm his_wr {
+    byte b;
+
+    state HW_Init:
+        // Not while the queue is being recovered or formatted
+        sfq_wait(HW_Init);
+        ee_open();
+        if (!his_scan())
+            proceed HW_Format;
+
+    state HW_Spare_Lock:
+        sfq_lock(HW_Spare_Lock);
+
+    state HW_Spare:
+        // The erase ahead of the writer may have been cut short
+        if (!his_blank(his_after(his_sn))) {
+            his_sec [his_after(his_sn)].valid = NO;
+            ee_erase(HW_Spare, his_start(his_after(his_sn)),
+                his_start(his_after(his_sn)) + HIS_SECTOR - 1);
+            his_stat.erases++;
+        }
+        proceed HW_Ready;
+
+    state HW_Format:
+        sfq_lock(HW_Format);
+
+    state HW_Format_Erase:
+        ee_erase(HW_Format_Erase, HIS_BASE, HIS_BASE + (lword)HIS_SECTORS * HIS_SECTOR - 1);
+        his_stat.erases++;
+        his_open(0);
+
+    state HW_Ready:
+        sfq_unlock();
+        his_spare = YES;
+        his_ready = YES;
+
+    state HW_Wait:
+        if (his_erase != NONE || his_full [0] || his_full [1])
+            proceed HW_Lock;
+        when(HIS_EV_WORK, HW_Wait);
+        delay(HIS_FLUSH, HW_Flush);
+        release;
+
+    state HW_Lock:
+        sfq_lock(HW_Lock);
+
+    state HW_Work:
+        if (his_erase != NONE)
+            proceed HW_Erase;
+        if (his_full [0] || his_full [1]) {
+            b = his_full [0] ? 0 : 1;
+            proceed HW_Program;
+        }
+        sfq_unlock();
+        proceed HW_Wait;
+
+    state HW_Erase:
+        ee_erase(HW_Erase, his_start(his_erase), his_start(his_erase) + HIS_SECTOR - 1);
+        his_stat.erases++;
+        his_erase = NONE;
+        his_spare = YES;
+        proceed HW_Work;
+
+    state HW_Program:
+        if (his_end [b] > his_from [b]) {
+            ee_write(HW_Program, his_adr [b] + his_from [b], his_buf [b] + his_from [b],
+                his_end [b] - his_from [b]);
+            his_stat.pages++;
+        }
+        his_from [b] = his_end [b];
+        his_full [b] = NO;
+        proceed HW_Work;
+
+    /*
+     * Purpose: Program the partial page, so that it survives a reset.
+    */
+    state HW_Flush:
+        if (his_end [his_cur] == his_from [his_cur])
+            proceed HW_Wait;
+        sfq_lock(HW_Flush);
+
+    state HW_Flush_Write:
+        b = his_cur;
+        if (his_end [b] > his_from [b]) {
+            ee_write(HW_Flush_Write, his_adr [b] + his_from [b], his_buf [b] + his_from [b],
+                his_end [b] - his_from [b]);
+            his_stat.pages++;
+            his_from [b] = his_end [b];
+        }
+        sfq_unlock();
+        proceed HW_Wait;
+}
+
+/*
+ * Purpose: Prepare his_fetch to return the last n (at most HIS_QMAX)
+ *          messages from node x.
+*/
+void his_last (word x, word n) {
+    lword r [HIS_QMAX], a;
+    byte h [HIS_EHDR];
+    word s, i, k, m, need;
+
+    if (n > HIS_QMAX)
+        n = HIS_QMAX;
+    his_qsince = NO;
+    his_qi = his_qn = (byte)n;
+
+    // Newest sector first; of its matches, the last need are kept in r
+    // and go in front of the newer ones
+    for (i = 0, s = his_sn; i < HIS_SECTORS && his_qi != 0;
+        i++, s = (s + HIS_SECTORS - 1) % HIS_SECTORS) {
+            if (!his_sec [s].valid || !his_has(s, x))
+                continue;
+            need = his_qi;
+            k = 0;
+            for (a = his_start(s) + HIS_SHDR; his_hdr(a, h); a += HIS_EHDR + h [0])
+                if (msg_getw(h + 1) == x)
+                    r [k++ % need] = a;
+            for (m = k < need ? k : need; m != 0; m--)
+                his_q [--his_qi] = r [--k % need];
+    }
+}
+
+/*
+ * Purpose: Prepare his_fetch to return the messages since time t.
+*/
+void his_since (lword t) {
+    word s, i, first = his_sn;
+    Boolean any = NO;
+
+    his_qsince = YES;
+    his_qt = t;
+    // The last sector that starts no later than t, else the oldest one
+    for (i = 1; i <= HIS_SECTORS; i++) {
+        s = (his_sn + i) % HIS_SECTORS;
+        if (!his_sec [s].valid || !his_sec [s].any)
+            continue;
+        if (!any || his_sec [s].t0 <= t)
+            first = s;
+        any = YES;
+        if (his_sec [s].t0 > t)
+            break;
+    }
+    his_qa = his_start(first) + HIS_SHDR;
+}
+
+/*
+ * Purpose: Return the next message of the query in e, or NO at the end.
+*/
+Boolean his_fetch (hisent_t *e) {
+    byte h [HIS_EHDR];
+    lword a;
+    word s;
+
+    while (1) {
+        if (his_qsince) {
+            if (!his_hdr(his_qa, h)) {
+                // On to the next sector, up to the one being filled
+                s = his_sect(his_qa);
+                if (s == his_sn)
+                    return NO;
+                do
+                    s = his_after(s);
+                while (!his_sec [s].valid && s != his_sn);
+                his_qa = his_start(s) + HIS_SHDR;
+                continue;
+            }
+            a = his_qa;
+            his_qa += HIS_EHDR + h [0];
+            if (his_getl(h + 5) < his_qt)
+                continue;
+        } else {
+            if (his_qi == his_qn)
+                return NO;
+            a = his_q [his_qi++];
+            // Its sector may have been erased since
+            if (!his_hdr(a, h))
+                continue;
+        }
+        e->len = h [0];
+        e->sender = msg_getw(h + 1);
+        e->seq = msg_getw(h + 3);
+        e->time = his_getl(h + 5);
+        his_read(a + HIS_EHDR, (byte*)e->text, e->len);
+        e->text [e->len] = '\0';
+        return YES;
+    }
+}
+
+void his_reset (void) {
+    his_stat.stored = his_stat.dropped = 0;
+    his_stat.pages = his_stat.erases = 0;
+}
@@ -0,0 +1,92 @@
+/* --------------------------------------------
+ * Purpose: History of received messages in the SPI flash. Every message
+ *          shown is appended (his_add, without waiting) to a circular
+ *          log after the store-and-forward queue (sfq.h): its sender,
+ *          sequence number, time and the first HIS_TEXT bytes of its
+ *          text. The time is in seconds and carries on from the last
+ *          entry after a reboot.
+ *
+ *          The log is a ring of HIS_SECTORS erase sectors, each starting
+ *          with a header (HIS_MAGIC and a serial number):
+ *
+ *            length, sender (word), sequence number (word), time (lword),
+ *            text
+ *
+ *          Entries are collected in two RAM page buffers; his_wr
+ *          programs a buffer once it is full, or every HIS_FLUSH msec for
+ *          the partial one, and erases a sector one ahead of the writer,
+ *          dropping the oldest entries. If both buffers are waiting to be
+ *          programmed, or the next sector is not erased yet, a message is
+ *          left out of the history rather than holding up the receiver.
+ *
+ *          In RAM, every sector has a summary: the time of its first
+ *          entry and a bitmap of the senders in it (HIS_FROM bits hashed
+ *          on the node ID, so a sector may be read in vain when two
+ *          senders share a bit). A query only reads the sectors that can
+ *          hold what it asks for: his_last for the last n messages from
+ *          a node, his_since for those since a time; his_fetch then
+ *          returns them one by one, oldest first.
+ -----------------------------------------------*/
+#ifndef __his_h__
+#define __his_h__
+
+#include "sysio.h"
+#include "app.h"
+#include "rcv.h"
+#include "sfq.h"
+
+// Flash area: HIS_SECTORS erase sectors after the queue
+#define HIS_BASE (SFQ_BASE + SFQ_SIZE)
+#define HIS_SECTOR SFQ_SECTOR
+#ifndef HIS_SECTORS
+#define HIS_SECTORS 32
+#endif
+
+#define HIS_PAGE SFQ_PAGE
+
+// Text bytes kept per message
+#define HIS_TEXT 200
+
+// Bits of a sector's sender summary (a power of two)
+#ifndef HIS_FROM
+#define HIS_FROM 64
+#endif
+
+// Most messages returned by his_last
+#define HIS_QMAX 16
+
+// Interval of programming a partial page (msec)
+#define HIS_FLUSH 2048
+
+// Sector header
+#define HIS_MAGIC 0x484C
+#define HIS_SHDR 4
+
+// Entry header; erased flash reads HIS_FREE for the length
+#define HIS_EHDR 9
+#define HIS_FREE 0xFF
+
+typedef struct {
+    lword time;
+    word sender, seq;
+    byte len;
+    char text [HIS_TEXT + 1];
+} hisent_t;
+
+typedef struct {
+    lword stored, dropped;
+    lword pages, erases; // flash program and erase operations
+} hisstat_t;
+
+extern hisstat_t his_stat;
+
+fsm his_wr;
+
+lword his_now (void);
+Boolean his_add (const msgview_t*, const char*, word);
+void his_last (word, word);
+void his_since (lword);
+Boolean his_fetch (hisent_t*);
+void his_reset (void);
+
+#endif
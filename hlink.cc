@@ -0,0 +1,240 @@
+/* --------------------------------------------
+ * Purpose: Binary host link (see hlink.h). Outgoing records are framed
+ *          into the console ring (see uout.h); a record written in
+ *          several parts holds the link until it is complete, so short
+ *          records from other processes cannot cut into it.
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "app.h"
+#include "bench.h"
+#include "dup.h"
+#include "pool.h"
+#include "uout.h"
+#include "plug_mesh.h"
+#include "sfq.h"
+#include "hlink.h"
+
+Boolean hlink_on;
+
+// A record is being written in parts
+static Boolean hlink_busy;
+#define HLINK_EV_FREE ((aword)&hlink_busy)
+
+// Framed bytes: at most two per byte, plus the END bytes
+static char hlink_out [2 * HLINK_CHUNK + 2];
+
+// Incoming record: header bytes go here, HLINK_SEND text to the message
+static byte hlink_hdr [HLINK_SEND_HDR];
+static word hlink_len;
+static Boolean hlink_esc, hlink_over;
+
+/*
+ * Purpose: Frame n (at most HLINK_CHUNK) bytes into hlink_out at o.
+ *          Returns the new end of hlink_out.
+*/
+static word hlink_frame (word o, const byte *p, word n) {
+    while (n--) {
+        byte c = *p++;
+        if (c == HLINK_END) {
+            hlink_out [o++] = HLINK_ESC;
+            c = HLINK_ESC_END;
+        } else if (c == HLINK_ESC) {
+            hlink_out [o++] = HLINK_ESC;
+            c = HLINK_ESC_ESC;
+        }
+        hlink_out [o++] = c;
+    }
+    return o;
+}
+
+/*
+ * Purpose: Start a record written in parts with its first n bytes (at
+ *          most HLINK_CHUNK), waiting in state st for the link and room.
+*/
+void hlink_begin (word st, const byte *p, word n) {
+    word o;
+
+    if (hlink_busy) {
+        when(HLINK_EV_FREE, st);
+        release;
+    }
+    // A leading END flushes any line noise the host may have collected
+    hlink_out [0] = HLINK_END;
+    o = hlink_frame(1, p, n);
+    uout_write(st, hlink_out, o);
+    hlink_busy = YES;
+}
+
+/*
+ * Purpose: Continue the record with up to HLINK_CHUNK of n bytes.
+ *          Returns how many were taken.
+*/
+word hlink_put (word st, const char *p, word n) {
+    if (n > HLINK_CHUNK)
+        n = HLINK_CHUNK;
+    uout_write(st, hlink_out, hlink_frame(0, (const byte*)p, n));
+    return n;
+}
+
+void hlink_end (word st) {
+    hlink_out [0] = HLINK_END;
+    uout_write(st, hlink_out, 1);
+    hlink_busy = NO;
+    trigger(HLINK_EV_FREE);
+}
+
+/*
+ * Purpose: Write a whole record of n (at most HLINK_CHUNK) bytes.
+*/
+void hlink_record (word st, const byte *p, word n) {
+    word o;
+
+    if (hlink_busy) {
+        when(HLINK_EV_FREE, st);
+        release;
+    }
+    hlink_out [0] = HLINK_END;
+    o = hlink_frame(1, p, n);
+    hlink_out [o++] = HLINK_END;
+    uout_write(st, hlink_out, o);
+}
+
+/*
+ * Purpose: Absorb a byte from the host into message m. Returns YES at
+ *          the end of a non-empty record; hlink_over then tells if it
+ *          was too long for the buffers.
+*/
+static Boolean hlink_byte (struct outmsg *m, byte c) {
+    if (c == HLINK_END) {
+        hlink_esc = NO;
+        if (hlink_len > HLINK_SEND_HDR && !hlink_over)
+            m->length = hlink_len - HLINK_SEND_HDR;
+        else
+            m->length = 0;
+        // Keep the length and hlink_over for the record's handler
+        return hlink_len > 0;
+    }
+    if (hlink_esc) {
+        hlink_esc = NO;
+        c = c == HLINK_ESC_END ? HLINK_END : c == HLINK_ESC_ESC ? HLINK_ESC : c;
+    } else if (c == HLINK_ESC) {
+        hlink_esc = YES;
+        return NO;
+    }
+    if (hlink_len < HLINK_SEND_HDR)
+        hlink_hdr [hlink_len] = c;
+    else if (hlink_len < HLINK_SEND_HDR + MAX_MSG_LEN)
+        m->text [hlink_len - HLINK_SEND_HDR] = c;
+    else
+        hlink_over = YES;
+    hlink_len++;
+    return NO;
+}
+
+static byte *hlink_putl (byte *p, lword v) {
+    msg_putw(p, (word)(v >> 16));
+    msg_putw(p + 2, (word)v);
+    return p + 4;
+}
+
+/*
+ * Purpose: Serve the host until it sends HLINK_EXIT. Message m is the
+ *          buffer for the messages it sends.
+*/
+fsm hlink_rx (struct outmsg *m) {
+    // Bytes read from the UART and how many of them have been parsed
+    byte rd [16];
+    word rdn, rdi;
+    // Reply to the record being handled
+    byte rep [1 + 2 + 2 + 4 + 4 + 4 + 4 + 2];
+
+    state HL_Start:
+        hlink_len = 0;
+        hlink_esc = hlink_over = NO;
+        rdn = rdi = 0;
+        hlink_on = YES;
+        uout_bin = YES;
+        rep [0] = HLINK_HELLO;
+        msg_putw(rep + 1, nodeId);
+
+    state HL_Hello:
+        hlink_record(HL_Hello, rep, 3);
+
+    state HL_Read:
+        rdn = io(HL_Read, UART_A, READ, (char*)rd, sizeof(rd));
+        rdi = 0;
+
+    state HL_Parse:
+        while (rdi < rdn)
+            if (hlink_byte(m, rd [rdi++]))
+                proceed HL_Record;
+        proceed HL_Read;
+
+    state HL_Record:
+        word len = hlink_len;
+        Boolean over = hlink_over;
+        hlink_len = 0;
+        hlink_over = NO;
+        switch (hlink_hdr [0]) {
+            case HLINK_SEND:
+                // Every send is answered, also a malformed or oversize one
+                // (with the tag bytes that arrived)
+                rep [0] = HLINK_SENT;
+                rep [1] = len > 1 ? hlink_hdr [1] : 0;
+                rep [2] = len > 2 ? hlink_hdr [2] : 0;
+                if (over || len <= HLINK_SEND_HDR ||
+                    !addr_valid(msg_getw(hlink_hdr + 3))) {
+                        rep [3] = MSG_RES_REJECTED;
+                        proceed HL_Reply;
+                }
+                m->receiverId = msg_getw(hlink_hdr + 3);
+                m->kind = MSG_KIND_DATA;
+                m->prio = (hlink_hdr [5] & HLINK_URGENT) ?
+                    MSG_PRIO_URGENT : MSG_PRIO_NORMAL;
+                call send(m, HL_Sent);
+                break;
+
+            case HLINK_STATS:
+                if (over)
+                    proceed HL_Parse;
+                proceed HL_Stats;
+                break;
+
+            case HLINK_EXIT:
+                proceed HL_Exit;
+                break;
+
+            default:
+                // Unknown records are ignored
+                proceed HL_Parse;
+                break;
+        }
+
+    state HL_Sent:
+        if (m->result == MSG_RES_FAILED && sfq_on)
+            call sfq_put(m, HL_Result);
+
+    state HL_Result:
+        rep [3] = m->result;
+
+    state HL_Reply:
+        hlink_record(HL_Reply, rep, 4);
+        proceed HL_Parse;
+
+    state HL_Stats:
+        byte *p = rep;
+        *p++ = HLINK_STAT;
+        msg_putw(p, bench_stat.received);
+        msg_putw(p + 2, bench_stat.lost);
+        p = hlink_putl(p + 4, dup_stat.hits);
+        p = hlink_putl(p, mesh_stat.forwarded);
+        p = hlink_putl(p, mesh_stat.rxqnewest + mesh_stat.rxqoldest + mesh_stat.rxqprio);
+        p = hlink_putl(p, uout_stat.dropped);
+        msg_putw(p, pool_stat.failed);
+        hlink_record(HL_Stats, rep, sizeof(rep));
+        proceed HL_Parse;
+
+    state HL_Exit:
+        hlink_on = uout_bin = NO;
+        finish;
+}
@@ -0,0 +1,65 @@
+/* --------------------------------------------
+ * Purpose: Binary host link. In this mode the console carries compact
+ *          records instead of the menu and text, for a gateway program
+ *          on a PC. Records are SLIP framed (RFC 1055): each one ends
+ *          with HLINK_END, and HLINK_END / HLINK_ESC bytes inside it are
+ *          sent as HLINK_ESC HLINK_ESC_END / HLINK_ESC HLINK_ESC_ESC.
+ *          Word fields are big-endian.
+ *
+ *          Host to node:
+ *            HLINK_SEND   tag (word), receiver (word), flags (HLINK_URGENT),
+ *                         text
+ *            HLINK_STATS  (nothing)
+ *            HLINK_EXIT   (nothing): back to the menu
+ *
+ *          Node to host:
+ *            HLINK_HELLO  node ID (word): the link is up
+ *            HLINK_SENT   tag (word), result (MSG_RES_*) of a HLINK_SEND;
+ *                         MSG_RES_REJECTED for an invalid receiver, no
+ *                         text, or more than MAX_MSG_LEN bytes of it
+ *            HLINK_RECV   kind, then sender, receiver, sequence number
+ *                         (words), text: a received message
+ *            HLINK_STAT   received, lost (words), duplicates, relayed,
+ *                         receive queue drops, console drops (lwords),
+ *                         pool failures (word)
+ -----------------------------------------------*/
+#ifndef __hlink_h__
+#define __hlink_h__
+
+#include "sysio.h"
+#include "app.h"
+
+// Framing bytes
+#define HLINK_END 0xC0
+#define HLINK_ESC 0xDB
+#define HLINK_ESC_END 0xDC
+#define HLINK_ESC_ESC 0xDD
+
+// Record types
+#define HLINK_SEND 0x01
+#define HLINK_STATS 0x02
+#define HLINK_EXIT 0x03
+#define HLINK_HELLO 0x80
+#define HLINK_RECV 0x81
+#define HLINK_SENT 0x82
+#define HLINK_STAT 0x83
+
+// HLINK_SEND flags
+#define HLINK_URGENT 0x01
+
+// Bytes of a HLINK_SEND record before the text
+#define HLINK_SEND_HDR 6
+
+// Most bytes framed by one call (the rest is left to the next one)
+#define HLINK_CHUNK 64
+
+extern Boolean hlink_on;
+
+void hlink_begin (word, const byte*, word);
+word hlink_put (word, const char*, word);
+void hlink_end (word);
+void hlink_record (word, const byte*, word);
+
+fsm hlink_rx (struct outmsg*);
+
+#endif
@@ -0,0 +1,36 @@
+/* --------------------------------------------
+ * Purpose: Millisecond clock (see mstime.h) built on a utimer, which
+ *          the system counts down every msec.
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "mstime.h"
+
+// The utimer is reloaded well before it can run down to zero
+#define MSTIME_UT_SPAN 60000
+#define MSTIME_UT_RELOAD 30000
+
+// Clock: base + time elapsed on the utimer
+static word mstime_ut;
+static lword mstime_base;
+
+/*
+ * Purpose: Keep folding the utimer into the clock base.
+*/
+fsm mstime_tick {
+    state MT_Tick:
+        mstime_base += MSTIME_UT_SPAN - mstime_ut;
+        utimer_set(mstime_ut, MSTIME_UT_SPAN);
+        delay(MSTIME_UT_RELOAD, MT_Tick);
+        release;
+}
+
+void mstime_init () {
+    utimer_add(&mstime_ut);
+    utimer_set(mstime_ut, MSTIME_UT_SPAN);
+    mstime_base = 0;
+    runfsm mstime_tick;
+}
+
+lword mstime () {
+    return mstime_base + (MSTIME_UT_SPAN - mstime_ut);
+}
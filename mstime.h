@@ -0,0 +1,13 @@
+/* --------------------------------------------
+ * Purpose: Free-running millisecond clock (PicOS msec, i.e., 1/1024 s)
+ *          used for timestamps and round-trip measurements.
+ -----------------------------------------------*/
+#ifndef __mstime_h__
+#define __mstime_h__
+
+#include "sysio.h"
+
+void mstime_init (void);
+lword mstime (void);
+
+#endif
@@ -0,0 +1,453 @@
+/* --------------------------------------------
+ * Purpose: Multi-hop mesh routing plugin (see plug_mesh.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "tcvplug.h"
+#include "app.h"
+#include "plug_mesh.h"
+
+#if MSG_MESH_LEN != 10
+#error "MSG_MESH_LEN must match struct meshhdr"
+#endif
+
+#if MESH_NODES & (MESH_NODES - 1) || MESH_NODES < MESH_WAYS
+#error "MESH_NODES must be a power of two, at least MESH_WAYS"
+#endif
+
+static int tcv_ope_mesh (int, int, va_list);
+static int tcv_clo_mesh (int, int);
+static int tcv_rcv_mesh (int, address, int, int*, tcvadp_t*);
+static int tcv_frm_mesh (address, tcvadp_t*);
+static int tcv_out_mesh (address);
+static int tcv_xmt_mesh (address);
+
+const tcvplug_t plug_mesh =
+    { tcv_ope_mesh, tcv_clo_mesh, tcv_rcv_mesh, tcv_frm_mesh,
+      tcv_out_mesh, tcv_xmt_mesh, NULL,
+      0x0001 };
+
+meshstat_t mesh_stat;
+
+word mesh_rad = MESH_RAD;
+byte mesh_k = MESH_K, mesh_prob = MESH_PROB;
+
+// Session of every PHY (one at most), as in plug_null
+#define MESH_PHYS 3
+static int ndsc_mesh [MESH_PHYS] = { NONE, NONE, NONE };
+
+// Receive queue limit and policy of every session, and the queued frames
+// that are to give way to frames accepted over the limit
+static word rxq_cap [MESH_PHYS];
+static byte rxq_policy [MESH_PHYS];
+static word rxq_owed [MESH_PHYS];
+
+typedef struct {
+    lword seen; // bit i set = frame number fseq - 1 - i seen
+    word fseq; // highest frame number seen from the node
+    word arrived; // seconds() of the last frame from the node
+    word heard; // seconds() when last heard as a neighbor, 0 = never
+    word learned; // seconds() when the route was learned
+    word next; // next hop towards the node, 0 = no route
+    byte hops;
+    word used; // seconds() of the last frame from or via the node
+    word id; // 0 = entry free
+    Boolean known; // frames from the node have been seen (recently)
+} meshnode_t;
+
+// Everything known about the nodes heard from, hashed on the node ID
+static meshnode_t mesh_tab [MESH_NODES];
+
+// Number of the next frame originated here; it starts at random, so
+// that neighbors still holding the numbers sent before a reboot do not
+// take new frames for copies
+static word mesh_fseq;
+
+// Forwarding queue; for a flooded frame, the copies heard so far
+typedef struct {
+    address pkt;
+    word fseq;
+    word origin;
+    byte copies; // 0 = relayed to one next hop, never suppressed
+    Boolean urgent; // carries an urgent record
+} meshfwd_t;
+
+static meshfwd_t mesh_fwdq [MESH_FWDQ];
+static byte mesh_fwdh, mesh_fwdn;
+
+#define MESH_EV_FWD ((aword)mesh_fwdq)
+
+#define mesh_hdr(p) ((struct meshhdr*)((p) + 1))
+#define mesh_fresh(t) ((t) != 0 && (word)((word)seconds() - (t)) < MESH_STALE)
+
+/*
+ * Purpose: Relay the queued frames, each after a random delay so that
+ *          neighbors relaying the same flood do not collide.
+*/
+fsm mesh_fwd {
+    state MF_Wait:
+        if (mesh_fwdn == 0) {
+            when(MESH_EV_FWD, MF_Wait);
+            release;
+        }
+        // Copies of the frame may be heard from other relays meanwhile
+        delay(mesh_rad ? rnd() % mesh_rad + 1 : 0, MF_Send);
+        release;
+
+    state MF_Send:
+        meshfwd_t *f = mesh_fwdq + mesh_fwdh;
+        if (mesh_k != 0 && f->copies >= mesh_k) {
+            // Enough neighbors have rebroadcast it already
+            tcvp_dispose(f->pkt, TCV_DSP_DROP);
+            mesh_stat.suppressed++;
+        } else {
+            tcvp_dispose(f->pkt, f->urgent ? TCV_DSP_XMTU : TCV_DSP_XMT);
+            mesh_stat.forwarded++;
+        }
+        mesh_fwdh = (mesh_fwdh + 1) % MESH_FWDQ;
+        mesh_fwdn--;
+        proceed MF_Wait;
+}
+
+/*
+ * Purpose: Return the entry of node id, or NULL if it has none. With add,
+ *          a missing entry is made, in place of the least recently used
+ *          one of the MESH_WAYS it may take.
+*/
+static meshnode_t *mesh_node (word id, Boolean add) {
+    meshnode_t *e, *v = NULL;
+    word i, now = (word)seconds();
+
+    for (i = 0; i < MESH_WAYS; i++) {
+        e = mesh_tab + ((id * 7 + i) & (MESH_NODES - 1));
+        if (e->id == id) {
+            if (add)
+                e->used = now;
+            return e;
+        }
+        if (v == NULL || (v->id != 0 &&
+            (e->id == 0 || (word)(now - e->used) > (word)(now - v->used))))
+                v = e;
+    }
+    if (!add)
+        return NULL;
+    memset(v, 0, sizeof(meshnode_t));
+    v->id = id;
+    v->used = now;
+    return v;
+}
+
+/*
+ * Purpose: Return the next hop towards node id, or 0 if no fresh route
+ *          is known.
+*/
+word mesh_route (word id) {
+    meshnode_t *e;
+
+    if (id == 0 || (e = mesh_node(id, NO)) == NULL || !mesh_fresh(e->learned))
+        return 0;
+    return e->next;
+}
+
+Boolean mesh_neighbor (word id) {
+    meshnode_t *e;
+
+    return id != 0 && (e = mesh_node(id, NO)) != NULL && mesh_fresh(e->heard);
+}
+
+/*
+ * Purpose: Return the next hop for a frame: the route to the only
+ *          receiver of its records, or 0 (flood) if they go to several
+ *          nodes, are broadcast or the route is unknown.
+*/
+static word mesh_next (const byte *r, const byte *end) {
+    word dst = 0;
+
+    while (r + MSG_HDR_LEN <= end && ((const struct msg*)r)->kind != 0) {
+        word rcv = msg_getw(((const struct msg*)r)->receiverId);
+        if (!msg_unicast(rcv) || (dst != 0 && rcv != dst))
+            return 0;
+        dst = rcv;
+        r += MSG_HDR_LEN + ((const struct msg*)r)->length;
+    }
+    return mesh_route(dst);
+}
+
+/*
+ * Purpose: Return YES if frame fseq from the node with entry e has been
+ *          seen before, otherwise remember it (as in dup_check). What was
+ *          seen from a node silent for MESH_STALE sec is forgotten.
+*/
+static Boolean mesh_seen (meshnode_t *e, word fseq) {
+    word d = fseq - e->fseq;
+    Boolean known = e->known && mesh_fresh(e->arrived);
+
+    e->arrived = (word)seconds() | 1;
+    if (!known) {
+        e->known = YES;
+        e->fseq = fseq;
+        e->seen = 0;
+        return NO;
+    }
+    if (d != 0 && d < 0x8000) {
+        e->seen = d > MESH_SEEN ? 0 : ((e->seen << 1) | 1) << (d - 1);
+        e->fseq = fseq;
+        return NO;
+    }
+    d = e->fseq - fseq;
+    if (d == 0 || (d <= MESH_SEEN && (e->seen & ((lword)1 << (d - 1)))))
+        return YES;
+    if (d <= MESH_SEEN) {
+        e->seen |= (lword)1 << (d - 1);
+    } else {
+        // The node has restarted
+        e->fseq = fseq;
+        e->seen = 0;
+    }
+    return NO;
+}
+
+/*
+ * Purpose: Count a copy of a flooded frame heard while its rebroadcast
+ *          is still queued.
+*/
+static void mesh_heard (word origin, word fseq) {
+    byte i;
+
+    for (i = 0; i < mesh_fwdn; i++) {
+        meshfwd_t *f = mesh_fwdq + (mesh_fwdh + i) % MESH_FWDQ;
+        if (f->copies != 0 && f->origin == origin && f->fseq == fseq) {
+            f->copies++;
+            return;
+        }
+    }
+}
+
+static int mesh_phy (int fd) {
+    int phy;
+
+    for (phy = 0; phy < MESH_PHYS; phy++)
+        if (ndsc_mesh [phy] == fd && fd != NONE)
+            return phy;
+    return NONE;
+}
+
+/*
+ * Purpose: Set the receive queue limit (frames, 0 = none) and policy of
+ *          session fd.
+*/
+int mesh_rxlimit (int fd, word cap, byte policy) {
+    int phy = mesh_phy(fd);
+
+    if (phy == NONE || policy > MESH_RXQ_PRIO)
+        return NONE;
+    rxq_cap [phy] = cap;
+    rxq_policy [phy] = policy;
+    rxq_owed [phy] = 0;
+    return 0;
+}
+
+word mesh_rxcap (int fd) {
+    int phy = mesh_phy(fd);
+    return phy == NONE ? 0 : rxq_cap [phy];
+}
+
+byte mesh_rxpolicy (int fd) {
+    int phy = mesh_phy(fd);
+    return phy == NONE ? MESH_RXQ_NEWEST : rxq_policy [phy];
+}
+
+/*
+ * Purpose: Return YES if packet p, just taken from the receive queue of
+ *          session fd, is to be discarded to make up for a frame accepted
+ *          over the limit. The packets are taken oldest first; by
+ *          priority, urgent ones are kept.
+*/
+Boolean mesh_rxdrop (int fd, address p) {
+    int phy = mesh_phy(fd);
+    const byte *r, *end;
+    word over;
+
+    if (phy == NONE || rxq_owed [phy] == 0)
+        return NO;
+    // Only as many as the queue is still over its limit
+    over = tcv_qsize(fd, TCV_DSP_RCV) + 1;
+    over = over > rxq_cap [phy] ? over - rxq_cap [phy] : 0;
+    if (rxq_owed [phy] > over)
+        rxq_owed [phy] = over;
+    if (rxq_owed [phy] == 0)
+        return NO;
+
+    if (rxq_policy [phy] == MESH_RXQ_PRIO) {
+        r = frame_recs(p);
+        end = (const byte*)p + tcv_left(p) - 2;
+        while (r + MSG_HDR_LEN <= end && ((const struct msg*)r)->kind != 0) {
+            if (((const struct msg*)r)->kind & MSG_URGENT)
+                return NO;
+            r += MSG_HDR_LEN + ((const struct msg*)r)->length;
+        }
+    }
+    rxq_owed [phy]--;
+    if (rxq_policy [phy] == MESH_RXQ_PRIO)
+        mesh_stat.rxqprio++;
+    else
+        mesh_stat.rxqoldest++;
+    return YES;
+}
+
+static int tcv_ope_mesh (int phy, int fd, va_list plid) {
+    if (phy < 0 || phy >= MESH_PHYS || ndsc_mesh [phy] != NONE)
+        return NONE;
+
+    ndsc_mesh [phy] = fd;
+    rxq_cap [phy] = MESH_RXQ_CAP;
+    rxq_policy [phy] = MESH_RXQ_NEWEST;
+    rxq_owed [phy] = 0;
+    if (!running(mesh_fwd)) {
+        mesh_fseq = rnd();
+        runfsm mesh_fwd;
+    }
+    return 0;
+}
+
+static int tcv_clo_mesh (int phy, int fd) {
+    if (phy < 0 || phy >= MESH_PHYS || ndsc_mesh [phy] != fd)
+        return NONE;
+
+    ndsc_mesh [phy] = NONE;
+    return 0;
+}
+
+static int tcv_rcv_mesh (int phy, address p, int len, int *ses,
+            tcvadp_t *bounds) {
+    struct meshhdr *h = mesh_hdr(p);
+    const byte *r, *end;
+    Boolean mine, others, urgent;
+    word origin, hopsrc, hopdst, fseq, hops;
+    meshnode_t *e;
+    address q;
+
+    if (phy < 0 || phy >= MESH_PHYS || (*ses = ndsc_mesh [phy]) == NONE)
+        return TCV_DSP_PASS;
+
+    if (len < MSG_FRAME_OVH) {
+        mesh_stat.filtered++;
+        return TCV_DSP_DROP;
+    }
+    origin = msg_getw(h->origin);
+    hopsrc = msg_getw(h->hopSrc);
+    hopdst = msg_getw(h->hopDst);
+    fseq = msg_getw(h->fseq);
+    if (origin == nodeId || origin == 0 || origin > MAX_NODE_ID ||
+        h->ttl == 0 || h->ttl > MESH_TTL ||
+        hopsrc == 0 || hopsrc > MAX_NODE_ID) {
+            mesh_stat.filtered++;
+            return TCV_DSP_DROP;
+    }
+
+    // The last-hop sender is a neighbor; the origin is reachable via it
+    mesh_node(hopsrc, YES)->heard = (word)seconds() | 1;
+    e = mesh_node(origin, YES);
+    hops = MESH_TTL - h->ttl + 1;
+    if (e->next == 0 || hops <= e->hops || !mesh_fresh(e->learned)) {
+        e->next = hopsrc;
+        e->hops = (byte)hops;
+        e->learned = (word)seconds() | 1;
+    }
+
+    if (mesh_seen(e, fseq)) {
+        if (hopdst == 0)
+            mesh_heard(origin, fseq);
+        mesh_stat.seen++;
+        return TCV_DSP_DROP;
+    }
+
+    r = frame_recs(p);
+    end = (const byte*)p + len - 2;
+    mine = others = urgent = NO;
+    while (r + MSG_HDR_LEN <= end && ((const struct msg*)r)->kind != 0) {
+        word rcv = msg_getw(((const struct msg*)r)->receiverId);
+        if (((const struct msg*)r)->kind & MSG_URGENT)
+            urgent = YES;
+        if (msg_for_me(rcv))
+            mine = YES;
+        if (rcv != nodeId)
+            others = YES;
+        r += MSG_HDR_LEN + ((const struct msg*)r)->length;
+    }
+
+    // Relay a copy if this node may, and somebody else needs it
+    if (others && h->ttl > 1 && (hopdst == 0 || hopdst == nodeId)) {
+        meshfwd_t *f;
+        if (hopdst == 0 && mesh_prob < 100 && rnd() % 100 >= mesh_prob) {
+            mesh_stat.suppressed++;
+        } else if (mesh_fwdn == MESH_FWDQ ||
+            (q = tcvp_new(len, TCV_DSP_PASS, *ses)) == NULL) {
+                mesh_stat.dropped++;
+        } else {
+            memcpy(q, p, len);
+            msg_putw(mesh_hdr(q)->hopSrc, nodeId);
+            msg_putw(mesh_hdr(q)->hopDst,
+                mesh_next(frame_recs(q), (byte*)q + len - 2));
+            mesh_hdr(q)->ttl--;
+            f = mesh_fwdq + (mesh_fwdh + mesh_fwdn) % MESH_FWDQ;
+            f->pkt = q;
+            f->origin = origin;
+            f->fseq = fseq;
+            // The frame itself is the first copy heard
+            f->copies = hopdst == 0;
+            f->urgent = urgent;
+            mesh_fwdn++;
+            trigger(MESH_EV_FWD);
+        }
+    }
+
+    if (!mine) {
+        mesh_stat.filtered++;
+        return TCV_DSP_DROP;
+    }
+
+    // Keep the receive queue within its limit. The session cannot be
+    // touched from here, so a queued frame that is to give way is
+    // discarded by the receiver when it takes it (mesh_rxdrop); while the
+    // receiver is held up, the queue may grow to twice the limit, and
+    // then the new frame gives way whatever the policy
+    if (rxq_cap [phy] != 0 && tcv_qsize(*ses, TCV_DSP_RCV) >= rxq_cap [phy]) {
+        if (tcv_qsize(*ses, TCV_DSP_RCV) < 2 * rxq_cap [phy] &&
+            (rxq_policy [phy] == MESH_RXQ_OLDEST ||
+            (rxq_policy [phy] == MESH_RXQ_PRIO && urgent))) {
+                rxq_owed [phy]++;
+        } else {
+            mesh_stat.rxqnewest++;
+            return TCV_DSP_DROP;
+        }
+    }
+    mesh_stat.accepted++;
+    bounds->head = bounds->tail = 0;
+    return TCV_DSP_RCV;
+}
+
+static int tcv_frm_mesh (address p, tcvadp_t *bounds) {
+    return bounds->head = bounds->tail = 0;
+}
+
+/*
+ * Purpose: Fill in the mesh header of a frame originated here.
+*/
+static int tcv_out_mesh (address p) {
+    struct meshhdr *h = mesh_hdr(p);
+
+    if (msg_getw(h->origin) == 0) {
+        msg_putw(h->origin, nodeId);
+        msg_putw(h->hopSrc, nodeId);
+        msg_putw(h->hopDst,
+            mesh_next(frame_recs(p), (byte*)p + tcvp_length(p) - 2));
+        h->ttl = MESH_TTL;
+        msg_putw(h->fseq, mesh_fseq);
+        mesh_fseq++;
+    }
+    return TCV_DSP_XMT;
+}
+
+static int tcv_xmt_mesh (address p) {
+    return TCV_DSP_DROP;
+}
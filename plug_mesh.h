@@ -0,0 +1,119 @@
+/* --------------------------------------------
+ * Purpose: Multi-hop mesh routing plugin. Every frame carries a mesh
+ *          header after the network ID: the node it originates from, the
+ *          node that sent it on the last hop, the relay it is meant for
+ *          (0 = any), the remaining hop count and a per-origin frame
+ *          number. The plugin fills the header in for outgoing frames
+ *          and, for incoming ones:
+ *
+ *          - notes the last-hop sender in the neighbor table,
+ *          - learns the route back to the origin (via the last-hop sender,
+ *            if it is no longer than the known one or that one is stale),
+ *          - drops frames it has already seen (per-origin window of frame
+ *            numbers, forgotten when the origin is stale; numbering
+ *            starts at random after a boot), so flooding ends,
+ *          - relays frames addressed to it or to any relay that carry
+ *            records for other nodes, while hops remain: to the next hop
+ *            of a known route when all records go to one node, otherwise
+ *            by flooding, after a short random delay from the forwarding
+ *            queue (frames with urgent records go out ahead of the
+ *            PHY's queue, see aggr.h),
+ *          - skips its own rebroadcast of a flooded frame if, by the end
+ *            of that delay, it has heard the frame mesh_k times (from its
+ *            first sender and other relays; counter-based, as in
+ *            Trickle), or at random with probability 100 - mesh_prob
+ *            percent,
+ *          - queues the frame for the application only when one of its
+ *            records is for this node, broadcast or a group it has joined,
+ *            and only while the session's receive queue is below its
+ *            limit; at the limit, the session's policy drops the new
+ *            frame, or queues it and has the receiver discard the oldest
+ *            queued one (mesh_rxdrop), or the oldest non-urgent one only
+ *            when the new frame is urgent. Those queued over the limit
+ *            never make the queue longer than twice the limit.
+ *
+ *          The nodes heard from are kept in a table of MESH_NODES
+ *          entries hashed on the node ID, whatever the number of nodes:
+ *          a node may take one of MESH_WAYS entries, and a new one
+ *          replaces the least recently used of them, losing its route and
+ *          frame numbers (a copy of a frame from it may then be relayed
+ *          once more; the receiver's dup_check still drops it).
+ -----------------------------------------------*/
+#ifndef __plug_mesh_h__
+#define __plug_mesh_h__
+
+#include "sysio.h"
+#include "tcvplug.h"
+#include "app.h"
+
+// Hop count of a new frame
+#ifndef MESH_TTL
+#define MESH_TTL 8
+#endif
+
+// Frames waiting to be relayed
+#ifndef MESH_FWDQ
+#define MESH_FWDQ 8
+#endif
+
+// Defaults of the flood suppression parameters: upper bound of the random
+// relay delay (msec), copies heard that cancel a rebroadcast (0 = never),
+// rebroadcast probability (percent)
+#define MESH_RAD 16
+#define MESH_K 3
+#define MESH_PROB 100
+
+// Routes and neighbors not heard from for this long are forgotten (sec)
+#define MESH_STALE 60
+
+// Entries of the node table (a power of two) and those a node may take
+#ifndef MESH_NODES
+#define MESH_NODES 32
+#endif
+#define MESH_WAYS 4
+
+// Frame numbers remembered before the highest one, per origin
+#define MESH_SEEN 32
+
+// Default limit of a session's receive queue (frames, 0 = none)
+#ifndef MESH_RXQ_CAP
+#define MESH_RXQ_CAP 8
+#endif
+
+// What gives way when the receive queue is full
+#define MESH_RXQ_NEWEST 0 // the arriving frame
+#define MESH_RXQ_OLDEST 1 // the frame at the head of the queue
+#define MESH_RXQ_PRIO 2 // the oldest non-urgent one for an urgent frame,
+                        // else the new one
+
+// Mesh header, between the network ID and the first record
+// (the word fields are read and written with msg_getw/msg_putw)
+struct meshhdr {
+    byte origin [2];
+    byte hopSrc [2];
+    byte hopDst [2]; // 0 = any node may relay
+    byte fseq [2];
+    byte ttl;
+    byte spare;
+};
+
+typedef struct {
+    lword accepted, filtered, seen, forwarded, suppressed, dropped;
+    // Frames dropped at the receive queue limit: the arriving one, the
+    // oldest one, the oldest non-urgent one (by priority)
+    lword rxqnewest, rxqoldest, rxqprio;
+} meshstat_t;
+
+extern const tcvplug_t plug_mesh;
+extern meshstat_t mesh_stat;
+extern word mesh_rad;
+extern byte mesh_k, mesh_prob;
+
+int mesh_rxlimit (int, word, byte);
+word mesh_rxcap (int);
+byte mesh_rxpolicy (int);
+Boolean mesh_rxdrop (int, address);
+word mesh_route (word);
+Boolean mesh_neighbor (word);
+
+#endif
@@ -0,0 +1,53 @@
+/* --------------------------------------------
+ * Purpose: Pool of fixed-size buffers (see pool.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "app.h"
+#include "pool.h"
+
+#if POOL_BUFS > 255
+#error "POOL_BUFS must fit in a byte"
+#endif
+
+static word pool_mem [POOL_BUFS] [POOL_BUF_SZ / 2];
+
+// Free list: indexes of the free buffers, used as a stack
+static byte pool_free [POOL_BUFS];
+static byte pool_nfree;
+
+poolstat_t pool_stat;
+
+void pool_init () {
+    byte i;
+
+    for (i = 0; i < POOL_BUFS; i++)
+        pool_free [i] = i;
+    pool_nfree = POOL_BUFS;
+    memset(&pool_stat, 0, sizeof(pool_stat));
+}
+
+/*
+ * Purpose: Return a free buffer, or NULL if there is none.
+*/
+char *pool_get () {
+    if (pool_nfree == 0) {
+        pool_stat.failed++;
+        return NULL;
+    }
+    if (++(pool_stat.used) > pool_stat.maxused)
+        pool_stat.maxused = pool_stat.used;
+    return (char*)(pool_mem [pool_free [--pool_nfree]]);
+}
+
+void pool_put (char *b) {
+    pool_free [pool_nfree++] = (byte)(((word*)b - pool_mem [0]) / (POOL_BUF_SZ / 2));
+    pool_stat.used--;
+}
+
+/*
+ * Purpose: Restart the statistics from the current state of the pool.
+*/
+void pool_reset () {
+    pool_stat.maxused = pool_stat.used;
+    pool_stat.failed = 0;
+}
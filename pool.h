@@ -0,0 +1,38 @@
+/* --------------------------------------------
+ * Purpose: Pool of fixed-size buffers, each big enough for one frame,
+ *          set aside at link time instead of being taken from the heap.
+ *          Buffers that come and go with the traffic (see frag.cc) thus
+ *          cannot fragment the heap, and getting or returning one is a
+ *          constant-time push or pop on a free list.
+ *
+ *          When the pool is empty pool_get fails rather than waiting:
+ *          the caller drops what it was about to store, and the sender
+ *          (or the reliable layer) sends it again later.
+ -----------------------------------------------*/
+#ifndef __pool_h__
+#define __pool_h__
+
+#include "sysio.h"
+#include "app.h"
+
+// Buffer size (bytes, a whole number of words)
+#define POOL_BUF_SZ ((CC1350_BUF_SZ + 1) & ~1)
+
+// Number of buffers: enough for FRAG_SLOTS messages of MAX_MSG_LEN in
+// reassembly at once (checked in frag.cc)
+#ifndef POOL_BUFS
+#define POOL_BUFS 20
+#endif
+
+typedef struct {
+    word used, maxused, failed;
+} poolstat_t;
+
+extern poolstat_t pool_stat;
+
+void pool_init (void);
+char *pool_get (void);
+void pool_put (char*);
+void pool_reset (void);
+
+#endif
@@ -0,0 +1,46 @@
+/* --------------------------------------------
+ * Purpose: Zero-copy access to received frames (see rcv.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "tcv.h"
+#include "app.h"
+#include "rcv.h"
+
+/*
+ * Purpose: Start walking a packet returned by tcv_rnp.
+*/
+void rcv_open (rcvpkt_t *r, address packet) {
+    r->packet = packet;
+    // Records start after the network ID and mesh header and end before
+    // the CRC
+    r->next = frame_recs(packet);
+    r->end = (byte*)packet + tcv_left(packet) - 2;
+}
+
+/*
+ * Purpose: Return a view of the next record. At the padding, or at a
+ *          record that would extend past the frame, the walk ends: the
+ *          packet is released and NO is returned.
+*/
+Boolean rcv_next (rcvpkt_t *r, msgview_t *v) {
+    const struct msg *m = (const struct msg*)(r->next);
+
+    if (r->next == NULL)
+        return NO;
+
+    if (r->next + MSG_HDR_LEN > r->end || m->kind == 0 ||
+        (byte*)m->payload + m->length > r->end) {
+            r->next = NULL;
+            tcv_endp(r->packet);
+            return NO;
+    }
+
+    v->kind = m->kind;
+    v->senderId = msg_getw(m->senderId);
+    v->receiverId = msg_getw(m->receiverId);
+    v->sequenceNumber = msg_getw(m->sequenceNumber);
+    v->data = m->payload;
+    v->len = m->length;
+    r->next = (byte*)m->payload + m->length;
+    return YES;
+}
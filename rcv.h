@@ -0,0 +1,35 @@
+/* --------------------------------------------
+ * Purpose: Zero-copy access to received frames. A frame is walked
+ *          record by record; every record is handed out as a view
+ *          (header fields + pointer and length of the payload) into the
+ *          TCV buffer, checked against the end of the frame. Nothing is
+ *          copied and nothing relies on the payload being terminated.
+ *
+ *          The buffer stays allocated until the walk ends: a view is only
+ *          valid up to the next rcv_next, and whatever must outlive it
+ *          (fragments, records held for in-order delivery) is copied out.
+ *          The end of the walk returns the buffer with tcv_endp.
+ -----------------------------------------------*/
+#ifndef __rcv_h__
+#define __rcv_h__
+
+#include "sysio.h"
+#include "app.h"
+
+typedef struct {
+    address packet;
+    byte *next, *end; // next record, end of records (CRC follows)
+} rcvpkt_t;
+
+typedef struct {
+    byte kind;
+    word senderId, receiverId;
+    word sequenceNumber;
+    const char *data;
+    word len;
+} msgview_t;
+
+void rcv_open (rcvpkt_t*, address);
+Boolean rcv_next (rcvpkt_t*, msgview_t*);
+
+#endif
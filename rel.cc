@@ -0,0 +1,242 @@
+/* --------------------------------------------
+ * Purpose: Acknowledgements, the send window and retransmission
+ *          timeouts (see rel.h). There is one window, owned by the
+ *          transfer send is working on.
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "app.h"
+#include "rel.h"
+#include "mstime.h"
+
+Boolean rel_enabled = NO;
+
+#if REL_PEERS & (REL_PEERS - 1)
+#error "REL_PEERS must be a power of two"
+#endif
+
+#define rel_hash(n) (((n) * 7) & (REL_PEERS - 1))
+
+// RTT estimate per destination, in msec scaled by 8 (srtt) and 4
+// (rttvar); zero srtt = no sample yet
+typedef struct {
+    word srtt, rttvar;
+    word dest; // 0 = entry free
+} relrtt_t;
+
+static relrtt_t rel_rtt [REL_PEERS];
+
+// Records in flight
+typedef struct {
+    lword sent, deadline;
+    word seq, rto;
+    byte frag, tries;
+    Boolean busy;
+} relslot_t;
+
+static relslot_t rel_win [REL_WINDOW];
+static word rel_dest;
+
+// Receiver side: per sender, the highest sequence number received and
+// a bitmap of the REL_SACK_BITS numbers before it
+typedef struct {
+    word last, bits;
+    word sender; // 0 = entry free
+} relrx_t;
+
+static relrx_t rel_rx [REL_PEERS];
+
+static void rel_sample (word dest, word rtt) {
+    relrtt_t *r = rel_rtt + rel_hash(dest);
+    word err;
+
+    if (r->dest != dest || r->srtt == 0) {
+        // Another destination's estimate gives way
+        r->dest = dest;
+        r->srtt = rtt << 3;
+        r->rttvar = rtt << 1;
+        return;
+    }
+    // srtt += (rtt - srtt) / 8, rttvar += (|rtt - srtt| - rttvar) / 4
+    err = rtt > (r->srtt >> 3) ? rtt - (r->srtt >> 3) : (r->srtt >> 3) - rtt;
+    r->srtt = r->srtt - (r->srtt >> 3) + rtt;
+    r->rttvar = r->rttvar - (r->rttvar >> 2) + err;
+}
+
+/*
+ * Purpose: Current retransmission timeout for dest.
+*/
+static word rel_rto (word dest) {
+    relrtt_t *r;
+    word rto;
+
+    if ((r = rel_rtt + rel_hash(dest))->dest != dest || r->srtt == 0)
+        return REL_RTO_INIT;
+    rto = (r->srtt >> 3) + r->rttvar;
+    if (rto < REL_RTO_MIN)
+        return REL_RTO_MIN;
+    if (rto > REL_RTO_MAX)
+        return REL_RTO_MAX;
+    return rto;
+}
+
+/*
+ * Purpose: Start a transfer to dest with an empty window.
+*/
+void rel_start (word dest) {
+    int i;
+
+    rel_dest = dest;
+    for (i = 0; i < REL_WINDOW; i++)
+        rel_win [i].busy = NO;
+}
+
+/*
+ * Purpose: Return a free window slot, or -1 if the window is full.
+*/
+int rel_slot () {
+    int i;
+
+    for (i = 0; i < REL_WINDOW; i++)
+        if (!rel_win [i].busy)
+            return i;
+    return -1;
+}
+
+/*
+ * Purpose: Note that the record seq (fragment frag) has just been sent
+ *          from slot i. A busy slot means a retransmission: the timeout
+ *          is doubled.
+*/
+void rel_track (int i, word seq, byte frag) {
+    relslot_t *s = rel_win + i;
+
+    if (s->busy) {
+        s->tries++;
+        s->rto = s->rto >= REL_RTO_MAX / 2 ? REL_RTO_MAX : s->rto << 1;
+    } else {
+        s->busy = YES;
+        s->seq = seq;
+        s->frag = frag;
+        s->tries = 0;
+        s->rto = rel_rto(rel_dest);
+    }
+    s->sent = mstime();
+    s->deadline = s->sent + s->rto;
+}
+
+/*
+ * Purpose: Return a slot whose timeout has expired, or -1.
+*/
+int rel_expired () {
+    lword now = mstime();
+    int i;
+
+    for (i = 0; i < REL_WINDOW; i++)
+        if (rel_win [i].busy && (sint)(now - rel_win [i].deadline) >= 0)
+            return i;
+    return -1;
+}
+
+byte rel_tries (int i) {
+    return rel_win [i].tries;
+}
+
+word rel_seq (int i) {
+    return rel_win [i].seq;
+}
+
+byte rel_frag (int i) {
+    return rel_win [i].frag;
+}
+
+Boolean rel_idle () {
+    int i;
+
+    for (i = 0; i < REL_WINDOW; i++)
+        if (rel_win [i].busy)
+            return NO;
+    return YES;
+}
+
+/*
+ * Purpose: Msec until the earliest timeout in the window.
+*/
+word rel_wait () {
+    lword now = mstime();
+    word w = REL_RTO_MAX;
+    sint d;
+    int i;
+
+    for (i = 0; i < REL_WINDOW; i++) {
+        if (!rel_win [i].busy)
+            continue;
+        d = (sint)(rel_win [i].deadline - now);
+        if (d <= 0)
+            return 1;
+        if (d < w)
+            w = (word)d;
+    }
+    return w;
+}
+
+/*
+ * Purpose: Absorb an ACK record received from sender: free every slot
+ *          it covers.
+*/
+void rel_ack (word sender, const char *data, word len) {
+    word seq, map, d;
+    Boolean freed = NO;
+    int i;
+
+    if (len < REL_ACK_LEN || sender != rel_dest)
+        return;
+    seq = msg_getw(data);
+    map = msg_getw(data + 2);
+
+    for (i = 0; i < REL_WINDOW; i++) {
+        relslot_t *s = rel_win + i;
+        if (!s->busy)
+            continue;
+        d = seq - s->seq;
+        if (d == 0 || (d <= REL_SACK_BITS && (map & (1 << (d - 1))))) {
+            if (s->tries == 0)
+                rel_sample(sender, (word)(mstime() - s->sent));
+            s->busy = NO;
+            freed = YES;
+        }
+    }
+    if (freed)
+        trigger(REL_EV_ACK);
+}
+
+/*
+ * Purpose: Receiver: account for record seq from sender and return the
+ *          bitmap to acknowledge it with.
+*/
+word rel_sack (word sender, word seq) {
+    relrx_t *r = rel_rx + rel_hash(sender);
+    word d;
+
+    if (r->sender != sender) {
+        r->sender = sender;
+        r->last = seq;
+        r->bits = 0;
+        return 0;
+    }
+
+    d = seq - r->last;
+    if (d != 0 && d < 0x8000) {
+        // Newer than anything so far: slide the bitmap
+        r->bits = d > REL_SACK_BITS ? 0 :
+            (word)((((lword)r->bits << 1) | 1) << (d - 1));
+        r->last = seq;
+        return r->bits;
+    }
+
+    // Older (a retransmission): note it, report relative to seq
+    d = r->last - seq;
+    if (d == 0 || d > REL_SACK_BITS)
+        return d == 0 ? r->bits : 0;
+    r->bits |= 1 << (d - 1);
+    return d >= REL_SACK_BITS ? 0 : r->bits >> d;
+}
@@ -0,0 +1,81 @@
+/* --------------------------------------------
+ * Purpose: Reliable direct messaging. A record sent with MSG_ACKREQ is
+ *          acknowledged by its receiver with a MSG_KIND_ACK record; the
+ *          sender retransmits it with the same sequence number when the
+ *          acknowledgement does not arrive in time.
+ *
+ *          Up to REL_WINDOW records (e.g., the fragments of a long
+ *          message) are in flight at once. An ACK carries the sequence
+ *          number of the record it answers and a bitmap of which of the
+ *          REL_SACK_BITS numbers before it the receiver also has from
+ *          the same sender, so one ACK covers several records, a lost
+ *          ACK is made up for by the next one, and only the records
+ *          that are really missing get retransmitted.
+ *
+ *          The timeout follows the round-trip time measured for every
+ *          destination (smoothed RTT + 4 x RTT variance, samples from
+ *          retransmitted records are not used) and doubles with every
+ *          retransmission of a record.
+ *
+ *          The RTT estimates and the receiver's bitmaps are kept in
+ *          tables of REL_PEERS entries hashed on the node ID; a node that
+ *          finds its entry taken by another one starts afresh (from
+ *          REL_RTO_INIT, or with an empty bitmap, which can only cause an
+ *          extra retransmission).
+ -----------------------------------------------*/
+#ifndef __rel_h__
+#define __rel_h__
+
+#include "sysio.h"
+#include "app.h"
+
+// Records in flight
+#ifndef REL_WINDOW
+#define REL_WINDOW 8
+#endif
+
+// Retransmissions of a record before giving up
+#ifndef REL_RETRIES
+#define REL_RETRIES 5
+#endif
+
+// Entries of the per-node tables (a power of two)
+#ifndef REL_PEERS
+#define REL_PEERS 16
+#endif
+
+// Timeout bounds and the timeout before the first RTT sample (msec)
+#define REL_RTO_MIN 50
+#define REL_RTO_MAX 4000
+#define REL_RTO_INIT 500
+
+// ACK payload: acknowledged sequence number, bitmap (bit i set = the
+// number i + 1 before it was received too), both msg_putw words
+#define REL_ACK_LEN 4
+#define REL_SACK_BITS 16
+
+#if REL_WINDOW > REL_SACK_BITS
+#error "REL_WINDOW cannot exceed REL_SACK_BITS"
+#endif
+
+// Event triggered when an ACK frees records in the window
+#define REL_EV_ACK ((aword)&rel_enabled)
+
+extern Boolean rel_enabled;
+
+// Sender
+void rel_start (word);
+int rel_slot (void);
+void rel_track (int, word, byte);
+int rel_expired (void);
+byte rel_tries (int);
+word rel_seq (int);
+byte rel_frag (int);
+Boolean rel_idle (void);
+word rel_wait (void);
+void rel_ack (word, const char*, word);
+
+// Receiver
+word rel_sack (word, word);
+
+#endif
@@ -0,0 +1,230 @@
+/* --------------------------------------------
+ * Purpose: Optional in-order delivery (see reo.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "app.h"
+#include "rcv.h"
+#include "mstime.h"
+#include "reo.h"
+
+#if REO_SENDERS & (REO_SENDERS - 1)
+#error "REO_SENDERS must be a power of two"
+#endif
+
+static reoslot_t reo_slot [REO_SLOTS];
+
+// Per sender, hashed on the node ID; the entry of a sender with records
+// held is never taken by another one
+static reosnd_t reo_snd [REO_SENDERS];
+
+#define reo_sender(n) (reo_snd + (((n) * 7) & (REO_SENDERS - 1)))
+
+reostat_t reo_stat;
+word reo_hol;
+
+#define reo_expired(s) (reo_hol == 0 || mstime() - (s)->since >= reo_hol)
+#define reo_ordered(k) (msg_kind(k) == MSG_KIND_DATA || \
+    msg_kind(k) == MSG_KIND_FRAG || msg_kind(k) == MSG_KIND_BENCH)
+
+/*
+ * Purpose: Make next the next number expected from the sender with entry
+ *          n, and go past the numbers after it noted by reo_skip.
+*/
+static void reo_move (reosnd_t *n, word next) {
+    word d = next - n->next;
+
+    n->skip = d >= REO_SKIP ? 0 : n->skip >> d;
+    n->next = next;
+    while (n->skip & 1) {
+        n->next++;
+        n->skip >>= 1;
+    }
+}
+
+/*
+ * Purpose: Return the held record of sender that comes first in its
+ *          sequence, or NULL.
+*/
+static reoslot_t *reo_first (word sender) {
+    reoslot_t *s, *f = NULL;
+    word next = reo_sender(sender)->next;
+
+    for (s = reo_slot; s < reo_slot + REO_SLOTS; s++)
+        if (s->busy && s->sender == sender &&
+            (f == NULL || (wint)(s->seq - next) < (wint)(f->seq - next)))
+                f = s;
+    return f;
+}
+
+/*
+ * Purpose: Return the entry of sender. If it has none, take over the one
+ *          it hashes to, unless that one's sender has records held, to
+ *          expect the number after seq, and return NULL.
+*/
+static reosnd_t *reo_track (word sender, word seq) {
+    reosnd_t *n = reo_sender(sender);
+
+    if (n->sender == sender)
+        return n;
+    if (n->sender != 0 && reo_first(n->sender) != NULL)
+        return NULL;
+    n->sender = sender;
+    n->next = seq + 1;
+    n->skip = 0;
+    return NULL;
+}
+
+/*
+ * Purpose: Note that number seq of sender has been taken by a record that
+ *          is not ordered, so that the records after it need not wait.
+*/
+void reo_skip (word sender, word seq) {
+    reosnd_t *n;
+    word d;
+
+    if (sender == 0 || (n = reo_track(sender, seq)) == NULL)
+        return;
+    d = seq - n->next;
+    if (d == 0)
+        reo_move(n, seq + 1);
+    else if (d < REO_SKIP)
+        n->skip |= (lword)1 << d;
+    else if (d >= REO_SPAN && (word)(n->next - seq) > REO_SPAN) {
+        // Far off: the sender has restarted its numbering
+        n->next = seq + 1;
+        n->skip = 0;
+    }
+}
+
+/*
+ * Purpose: Decide about the record seen through v: return YES to deliver
+ *          it now, or copy it aside and return NO.
+*/
+Boolean reo_check (const msgview_t *v) {
+    reosnd_t *n;
+    reoslot_t *s, *f;
+    word d;
+    byte depth;
+
+    if (!reo_ordered(v->kind)) {
+        reo_skip(v->senderId, v->sequenceNumber);
+        return YES;
+    }
+    if (v->senderId == 0 ||
+        (n = reo_track(v->senderId, v->sequenceNumber)) == NULL)
+            return YES;
+
+    d = v->sequenceNumber - n->next;
+    if (d == 0) {
+        reo_move(n, n->next + 1);
+        return YES;
+    }
+
+    if (d >= REO_SPAN) {
+        if ((word)(n->next - v->sequenceNumber) <= REO_SPAN) {
+            // Its successors have gone already
+            reo_stat.late++;
+        } else {
+            // Far off: the sender has restarted its numbering
+            n->next = v->sequenceNumber + 1;
+            n->skip = 0;
+        }
+        return YES;
+    }
+
+    // Ahead of the next one: hold it, if there is room
+    f = NULL;
+    depth = 0;
+    for (s = reo_slot; s < reo_slot + REO_SLOTS; s++) {
+        if (!s->busy)
+            f = s;
+        else if (s->sender == v->senderId)
+            depth++;
+    }
+    if (f == NULL || depth >= REO_DEPTH) {
+        reo_stat.overflows++;
+        reo_move(n, v->sequenceNumber + 1);
+        return YES;
+    }
+
+    f->since = mstime();
+    f->sender = v->senderId;
+    f->receiverId = v->receiverId;
+    f->seq = v->sequenceNumber;
+    f->kind = v->kind;
+    f->len = v->len;
+    memcpy(f->data, v->data, v->len);
+    f->busy = YES;
+    if (++reo_stat.held > reo_stat.maxheld)
+        reo_stat.maxheld = reo_stat.held;
+    return NO;
+}
+
+/*
+ * Purpose: Take out a held record that is due: the next one of its
+ *          sender, one that can no longer be in order, or the first one
+ *          of a sender whose records have waited reo_hol msec. Fills v
+ *          (whose data stay valid until the next reo_check) and returns
+ *          YES, or returns NO if none is due.
+*/
+Boolean reo_next (msgview_t *v) {
+    reoslot_t *s, *f;
+    reosnd_t *n;
+    word d;
+
+    for (s = reo_slot; s < reo_slot + REO_SLOTS; s++) {
+        if (!s->busy)
+            continue;
+        f = reo_first(s->sender);
+        n = reo_sender(f->sender);
+        d = f->seq - n->next;
+        if (d == 0 || d >= 0x8000 || reo_expired(s))
+            break;
+    }
+    if (s == reo_slot + REO_SLOTS)
+        return NO;
+
+    if (d >= 0x8000) {
+        reo_stat.late++;
+    } else {
+        if (d != 0)
+            // Gave up waiting for the records before it
+            reo_stat.timeouts++;
+        reo_move(n, f->seq + 1);
+    }
+    v->kind = f->kind;
+    v->senderId = f->sender;
+    v->receiverId = f->receiverId;
+    v->sequenceNumber = f->seq;
+    v->data = f->data;
+    v->len = f->len;
+    f->busy = NO;
+    reo_stat.held--;
+    return YES;
+}
+
+/*
+ * Purpose: Return the msec until the first held record times out.
+*/
+word reo_wait (void) {
+    lword now = mstime();
+    word w = reo_hol;
+    sint d;
+    reoslot_t *s;
+
+    for (s = reo_slot; s < reo_slot + REO_SLOTS; s++) {
+        if (!s->busy)
+            continue;
+        d = (sint)(s->since + reo_hol - now);
+        if (d <= 0)
+            return 0;
+        if (d < w)
+            w = (word)d;
+    }
+    return w;
+}
+
+void reo_reset (void) {
+    reo_stat.maxheld = reo_stat.held;
+    reo_stat.late = reo_stat.timeouts = reo_stat.overflows = 0;
+}
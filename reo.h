@@ -0,0 +1,92 @@
+/* --------------------------------------------
+ * Purpose: Optional in-order delivery. Retransmissions and different
+ *          mesh paths let records from one sender arrive out of order;
+ *          in this mode a record that is ahead of the sender's next
+ *          expected sequence number is copied aside until the records
+ *          before it have arrived, or until it has waited reo_hol msec
+ *          (the head-of-line timeout), and then delivered in order.
+ *
+ *          A sender's numbers also advance for records that are not
+ *          ordered: ACKs and records for other nodes. Those that arrive
+ *          here are passed to reo_skip, which notes their numbers as
+ *          taken (up to REO_SKIP ahead of the next one), so they do not
+ *          leave a gap; a gap left by records that never arrive here
+ *          costs at most the timeout. A record that arrives after its
+ *          successors have been delivered is delivered at once, as late.
+ *
+ *          Held records are kept in REO_SLOTS static slots, at most
+ *          REO_DEPTH of them per sender; when there is no room, the
+ *          arriving record is delivered at once. The senders' next
+ *          numbers are kept in REO_SENDERS entries hashed on the node ID;
+ *          a sender whose entry is taken by another one starts afresh, or,
+ *          while the other one has records held, is not ordered. The
+ *          memory used is thus fixed at link time (REO_MEM bytes).
+ -----------------------------------------------*/
+#ifndef __reo_h__
+#define __reo_h__
+
+#include "sysio.h"
+#include "app.h"
+#include "rcv.h"
+
+// Records held at any time
+#ifndef REO_SLOTS
+#define REO_SLOTS 4
+#endif
+
+// Records held per sender
+#ifndef REO_DEPTH
+#define REO_DEPTH 3
+#endif
+
+// Senders tracked at once (a power of two)
+#ifndef REO_SENDERS
+#define REO_SENDERS 16
+#endif
+
+// Suggested head-of-line timeout (msec)
+#define REO_HOL 200
+
+// Farthest a record may be ahead of or behind the sender's next one;
+// beyond that the sender is taken to have restarted its numbering
+#define REO_SPAN 64
+
+// Numbers ahead of the next one that reo_skip can note (bits in an lword)
+#define REO_SKIP 32
+
+typedef struct {
+    lword since; // mstime() when held
+    word sender, receiverId, seq, len;
+    byte kind;
+    Boolean busy;
+    char data [MAX_PAYLOAD];
+} reoslot_t;
+
+typedef struct {
+    lword skip; // bit i set = number next + i taken by a record not ordered
+    word next; // next sequence number expected
+    word sender; // 0 = entry free
+} reosnd_t;
+
+// Static memory of the buffer
+#define REO_MEM (REO_SLOTS * sizeof(reoslot_t) + \
+    REO_SENDERS * sizeof(reosnd_t))
+
+typedef struct {
+    word held, maxheld;
+    lword late, timeouts, overflows;
+} reostat_t;
+
+extern reostat_t reo_stat;
+// Head-of-line timeout (msec), 0 = in-order delivery off
+extern word reo_hol;
+
+#define reo_held() (reo_stat.held != 0)
+
+Boolean reo_check (const msgview_t*);
+void reo_skip (word, word);
+Boolean reo_next (msgview_t*);
+word reo_wait (void);
+void reo_reset (void);
+
+#endif
@@ -0,0 +1,516 @@
+/* --------------------------------------------
+ * Purpose: Store-and-forward queue in the SPI flash (see sfq.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "storage.h"
+#include "app.h"
+#include "plug_mesh.h"
+#include "rel.h"
+#include "sfq.h"
+
+#if SFQ_SECTORS < 3
+#error "SFQ_SECTORS must be at least 3"
+#endif
+
+#if SFQ_SHDR + SFQ_EHDR + MAX_MSG_LEN > SFQ_SECTOR
+#error "MAX_MSG_LEN does not fit into a sector"
+#endif
+
+typedef struct {
+    lword adr; // of the entry in the flash
+    word receiver;
+    word age; // order of appending, oldest first
+    word due; // seconds() from which it may be sent again
+    byte tries; // failed attempts to send it
+    Boolean busy;
+} sfqent_t;
+
+static sfqent_t sfq_idx [SFQ_MAX];
+static word sfq_age;
+
+// RAM copy of the page being appended to; the bytes from sfq_wr up to
+// sfq_tail are not programmed yet
+static byte sfq_page [SFQ_PAGE];
+static lword sfq_tail, sfq_wr;
+
+// Sector being appended to and its serial number
+static word sfq_cur, sfq_serial;
+
+// The sector after sfq_cur is erased; the sector for sfq_drain to erase,
+// if any
+static Boolean sfq_spare;
+static int sfq_erase = NONE;
+#define SFQ_EV_SPARE ((aword)&sfq_spare)
+#define SFQ_EV_ERASE ((aword)&sfq_erase)
+
+// First entry found at boot that did not fit into the index (0 = none);
+// it and the messages after it are marked delivered by sfq_drain
+static lword sfq_over;
+
+// The log has been scanned
+static Boolean sfq_ready;
+#define SFQ_EV_READY ((aword)&sfq_ready)
+
+// Held while the flash is being programmed or read for sending
+static Boolean sfq_locked;
+#define SFQ_EV_FREE ((aword)&sfq_locked)
+
+sfqstat_t sfq_stat;
+Boolean sfq_on = YES;
+
+static const byte sfq_done = SFQ_DONE;
+
+#define sfq_start(s) (SFQ_BASE + (lword)(s) * SFQ_SECTOR)
+#define sfq_after(s) (((s) + 1) % SFQ_SECTORS)
+#define sfq_room() (SFQ_PAGE - (word)(sfq_tail & (SFQ_PAGE - 1)))
+
+/*
+ * Purpose: Take the flash for programming or erasing (or reading what is
+ *          being programmed), waiting in state st while it is taken.
+*/
+void sfq_lock (word st) {
+    if (sfq_locked) {
+        when(SFQ_EV_FREE, st);
+        release;
+    }
+    sfq_locked = YES;
+}
+
+void sfq_unlock (void) {
+    sfq_locked = NO;
+    trigger(SFQ_EV_FREE);
+}
+
+/*
+ * Purpose: Wait in state st until the log has been recovered, so that
+ *          sfq_drain is no longer scanning or formatting the flash.
+*/
+void sfq_wait (word st) {
+    if (!sfq_ready) {
+        when(SFQ_EV_READY, st);
+        release;
+    }
+}
+
+/*
+ * Purpose: Program the staged bytes (all in one page).
+*/
+static void sfq_flush (word st) {
+    if (sfq_tail == sfq_wr)
+        return;
+    ee_write(st, sfq_wr, sfq_page + (word)(sfq_wr & (SFQ_PAGE - 1)),
+        (word)(sfq_tail - sfq_wr));
+    sfq_wr = sfq_tail;
+    sfq_stat.pages++;
+}
+
+/*
+ * Purpose: Start appending to sector s with a new header.
+*/
+static void sfq_open (word s) {
+    sfq_cur = s;
+    sfq_serial++;
+    sfq_tail = sfq_wr = sfq_start(s);
+    msg_putw(sfq_page, SFQ_MAGIC);
+    msg_putw(sfq_page + 2, sfq_serial);
+    sfq_tail += SFQ_SHDR;
+}
+
+static Boolean sfq_index (lword adr, word receiver) {
+    sfqent_t *e;
+
+    for (e = sfq_idx; e < sfq_idx + SFQ_MAX; e++)
+        if (!e->busy) {
+            e->adr = adr;
+            e->receiver = receiver;
+            e->age = sfq_age++;
+            e->due = (word)seconds();
+            e->tries = 0;
+            e->busy = YES;
+            sfq_stat.queued++;
+            return YES;
+        }
+    return NO;
+}
+
+/*
+ * Purpose: Forget the messages queued in sector s, about to be erased.
+*/
+static void sfq_drop (word s) {
+    sfqent_t *e;
+
+    for (e = sfq_idx; e < sfq_idx + SFQ_MAX; e++)
+        if (e->busy && e->adr >= sfq_start(s) &&
+            e->adr < sfq_start(s) + SFQ_SECTOR) {
+                e->busy = NO;
+                sfq_stat.queued--;
+                sfq_stat.dropped++;
+        }
+}
+
+/*
+ * Purpose: Return the oldest queued message that is due and whose
+ *          receiver can be reached, or NULL.
+*/
+static sfqent_t *sfq_first (void) {
+    sfqent_t *e, *f = NULL;
+
+    for (e = sfq_idx; e < sfq_idx + SFQ_MAX; e++)
+        if (e->busy && (word)((word)seconds() - e->due) < 0x8000 &&
+            (mesh_route(e->receiver) != 0 ||
+            mesh_neighbor(e->receiver)) &&
+            (f == NULL || (wint)(e->age - f->age) < 0))
+                f = e;
+    return f;
+}
+
+/*
+ * Purpose: Return YES if sector s is erased throughout; an erase cut
+ *          short by a reset may leave its start erased but not the rest.
+*/
+static Boolean sfq_blank (word s) {
+    byte h [32];
+    lword a;
+    word i;
+
+    for (a = sfq_start(s); a < sfq_start(s) + SFQ_SECTOR; a += sizeof(h)) {
+        ee_read(a, h, sizeof(h));
+        for (i = 0; i < sizeof(h); i++)
+            if (h [i] != 0xFF)
+                return NO;
+    }
+    return YES;
+}
+
+static Boolean sfq_valid (word s) {
+    byte h [2];
+
+    ee_read(sfq_start(s), h, 2);
+    return msg_getw(h) == SFQ_MAGIC;
+}
+
+/*
+ * Purpose: Read the header of the entry at a (in sector s) into h; return
+ *          NO if the sector has no entry there.
+*/
+static Boolean sfq_entry (word s, lword a, byte *h) {
+    if (a + SFQ_EHDR > sfq_start(s) + SFQ_SECTOR)
+        return NO;
+    ee_read(a, h, SFQ_EHDR);
+    return h [0] != SFQ_FREE;
+}
+
+/*
+ * Purpose: Find the sector with the highest serial number, index the
+ *          messages still queued, oldest sector first, and continue the
+ *          log after its last entry. Returns NO if there is no log.
+*/
+static Boolean sfq_scan (void) {
+    byte h [SFQ_EHDR];
+    word s, i, len;
+    int last = NONE;
+    lword a;
+
+    for (s = 0; s < SFQ_SECTORS; s++) {
+        ee_read(sfq_start(s), h, SFQ_SHDR);
+        if (msg_getw(h) != SFQ_MAGIC)
+            continue;
+        if (last == NONE || (wint)(msg_getw(h + 2) - sfq_serial) > 0) {
+            last = s;
+            sfq_serial = msg_getw(h + 2);
+        }
+    }
+    if (last == NONE)
+        return NO;
+    sfq_cur = last;
+
+    for (i = 1; i <= SFQ_SECTORS; i++) {
+        s = (last + i) % SFQ_SECTORS;
+        if (!sfq_valid(s))
+            continue;
+        a = sfq_start(s) + SFQ_SHDR;
+        while (sfq_entry(s, a, h)) {
+            len = msg_getw(h + 4);
+            if (len > MAX_MSG_LEN || a + SFQ_EHDR + len > sfq_start(s) + SFQ_SECTOR) {
+                // Cut short by a reset: nothing more is appended here
+                a = sfq_start(s) + SFQ_SECTOR;
+                break;
+            }
+            if (h [0] == SFQ_LIVE && !sfq_index(a, msg_getw(h + 2))) {
+                if (sfq_over == 0)
+                    sfq_over = a;
+                sfq_stat.dropped++;
+            }
+            a += SFQ_EHDR + len;
+        }
+        if (s == last)
+            sfq_tail = sfq_wr = a;
+    }
+    return YES;
+}
+
+/*
+ * Purpose: Append the message to the log. On success its result becomes
+ *          MSG_RES_QUEUED.
+*/
+fsm sfq_put (struct outmsg * ptr) {
+    // The entry: its header, bytes staged so far, size and address
+    byte hdr [SFQ_EHDR];
+    word done, need;
+    lword adr;
+
+    state SP_Lock:
+        if (!sfq_ready) {
+            sfq_stat.dropped++;
+            finish;
+        }
+        sfq_lock(SP_Lock);
+
+    state SP_Start:
+        if (sfq_stat.queued == SFQ_MAX) {
+            sfq_stat.dropped++;
+            sfq_unlock();
+            finish;
+        }
+        need = SFQ_EHDR + ptr->length;
+        if (sfq_tail + need > sfq_start(sfq_cur) + SFQ_SECTOR)
+            proceed SP_Next;
+        hdr [0] = SFQ_LIVE;
+        hdr [1] = ptr->prio;
+        msg_putw(hdr + 2, ptr->receiverId);
+        msg_putw(hdr + 4, ptr->length);
+        adr = sfq_tail;
+        done = 0;
+
+    /*
+     * Purpose: Stage the entry, programming every page it fills.
+    */
+    state SP_Copy:
+        while (done < need) {
+            word n = need - done;
+            const byte * p;
+            if (done < SFQ_EHDR) {
+                p = hdr + done;
+                if (n > SFQ_EHDR - done)
+                    n = SFQ_EHDR - done;
+            } else {
+                p = (const byte*)ptr->text + (done - SFQ_EHDR);
+            }
+            if (n > sfq_room())
+                n = sfq_room();
+            memcpy(sfq_page + (word)(sfq_tail & (SFQ_PAGE - 1)), p, n);
+            sfq_tail += n;
+            done += n;
+            if ((sfq_tail & (SFQ_PAGE - 1)) == 0)
+                proceed SP_Page;
+        }
+        sfq_index(adr, ptr->receiverId);
+        sfq_stat.stored++;
+        ptr->result = MSG_RES_QUEUED;
+        sfq_unlock();
+        finish;
+
+    state SP_Page:
+        sfq_flush(SP_Page);
+        proceed SP_Copy;
+
+    /*
+     * Purpose: Move on to the next sector, once it is erased, and have
+     *          sfq_drain erase the one after it; the oldest messages go.
+    */
+    state SP_Next:
+        if (!sfq_spare) {
+            sfq_unlock();
+            when(SFQ_EV_SPARE, SP_Lock);
+            release;
+        }
+        sfq_flush(SP_Next);
+        sfq_open(sfq_after(sfq_cur));
+        sfq_spare = NO;
+        sfq_erase = sfq_after(sfq_cur);
+        sfq_drop(sfq_erase);
+        trigger(SFQ_EV_ERASE);
+        proceed SP_Start;
+}
+
+/*
+ * Purpose: Recover the log, then keep sending the queued messages whose
+ *          receivers are heard from, erase the sectors ahead of the
+ *          writer as sfq_put asks for it, and program the last partial
+ *          page every SFQ_POLL msec.
+*/
+fsm sfq_drain {
+    sfqent_t * cur;
+    word age;
+    // The message sent has been acknowledged
+    Boolean done;
+    // Allocated only while it is being sent
+    struct outmsg * msg;
+
+    state SD_Init:
+        ee_open();
+        if (!sfq_scan())
+            proceed SD_Format;
+
+    state SD_Spare_Lock:
+        sfq_lock(SD_Spare_Lock);
+
+    state SD_Spare:
+        // The erase ahead of the writer may have been cut short
+        if (!sfq_blank(sfq_after(sfq_cur))) {
+            sfq_drop(sfq_after(sfq_cur));
+            ee_erase(SD_Spare, sfq_start(sfq_after(sfq_cur)),
+                sfq_start(sfq_after(sfq_cur)) + SFQ_SECTOR - 1);
+            sfq_stat.erases++;
+        }
+
+    /*
+     * Purpose: Mark the messages that did not fit into the index as
+     *          delivered, so that they are dropped only once.
+    */
+    state SD_Cull:
+        byte h [SFQ_EHDR];
+        word s, len;
+        s = (word)((sfq_over - SFQ_BASE) / SFQ_SECTOR);
+        if (sfq_over == 0 || (sfq_over >= sfq_tail && s == sfq_cur)) {
+            sfq_over = 0;
+            sfq_unlock();
+            proceed SD_Ready;
+        }
+        if (!sfq_entry(s, sfq_over, h) || (len = msg_getw(h + 4)) > MAX_MSG_LEN ||
+            sfq_over + SFQ_EHDR + len > sfq_start(s) + SFQ_SECTOR) {
+            // On to the next sector of the log
+            do
+                s = sfq_after(s);
+            while (s != sfq_cur && !sfq_valid(s));
+            sfq_over = sfq_start(s) + SFQ_SHDR;
+            proceed SD_Cull;
+        }
+        if (h [0] == SFQ_LIVE)
+            ee_write(SD_Cull, sfq_over, &sfq_done, 1);
+        sfq_over += SFQ_EHDR + len;
+        proceed SD_Cull;
+
+    state SD_Format:
+        sfq_lock(SD_Format);
+
+    state SD_Format_Erase:
+        ee_erase(SD_Format_Erase, SFQ_BASE, SFQ_BASE + SFQ_SIZE - 1);
+        sfq_stat.erases++;
+        sfq_open(0);
+        sfq_unlock();
+
+    state SD_Ready:
+        sfq_spare = YES;
+        sfq_ready = YES;
+        trigger(SFQ_EV_READY);
+
+    state SD_Wait:
+        if (sfq_erase != NONE)
+            proceed SD_Erase_Lock;
+        when(SFQ_EV_ERASE, SD_Wait);
+        delay(SFQ_POLL, SD_Pick);
+        release;
+
+    /*
+     * Purpose: Erase the sector sfq_put has moved next to. On the first
+     *          lap after formatting, it is blank already.
+    */
+    state SD_Erase_Lock:
+        sfq_lock(SD_Erase_Lock);
+
+    state SD_Erase:
+        if (!sfq_blank(sfq_erase)) {
+            ee_erase(SD_Erase, sfq_start(sfq_erase), sfq_start(sfq_erase) + SFQ_SECTOR - 1);
+            sfq_stat.erases++;
+        }
+        sfq_erase = NONE;
+        sfq_spare = YES;
+        trigger(SFQ_EV_SPARE);
+        sfq_unlock();
+        proceed SD_Wait;
+
+    state SD_Pick:
+        if (sfq_erase != NONE)
+            proceed SD_Erase_Lock;
+        // Only an acknowledgement tells that a message has been
+        // delivered, so the queue waits while reliable mode is off
+        if (!rel_enabled || (cur = sfq_first()) == NULL)
+            proceed SD_Idle;
+        age = cur->age;
+
+    state SD_Lock:
+        sfq_lock(SD_Lock);
+
+    state SD_Flush:
+        // The entry may not be programmed yet
+        sfq_flush(SD_Flush);
+
+    state SD_Read:
+        byte h [SFQ_EHDR];
+        // The entry's sector may have been erased meanwhile; without
+        // memory for the message, it is tried again later
+        if (!cur->busy || cur->age != age ||
+            (msg = (struct outmsg*) umalloc(sizeof(struct outmsg))) == NULL) {
+                sfq_unlock();
+                proceed SD_Wait;
+        }
+        ee_read(cur->adr, h, SFQ_EHDR);
+        msg->kind = MSG_KIND_DATA;
+        msg->prio = h [1];
+        msg->receiverId = msg_getw(h + 2);
+        msg->length = msg_getw(h + 4);
+        ee_read(cur->adr + SFQ_EHDR, (byte*)msg->text, msg->length);
+        msg->text [msg->length] = '\0';
+        sfq_unlock();
+        call send(msg, SD_Sent);
+
+    state SD_Sent:
+        done = msg->result == MSG_RES_DELIVERED;
+        ufree(msg);
+        if (!done) {
+            // Still not acknowledged: try again after the others, waiting
+            // twice as long after every attempt, until SFQ_TRIES are made
+            if (!cur->busy || cur->age != age)
+                proceed SD_Wait;
+            if (++cur->tries < SFQ_TRIES) {
+                cur->due = (word)seconds() + (SFQ_BACKOFF << (cur->tries - 1));
+                cur->age = sfq_age++;
+                proceed SD_Wait;
+            }
+        }
+
+    state SD_Mark_Lock:
+        sfq_lock(SD_Mark_Lock);
+
+    state SD_Mark:
+        if (cur->busy && cur->age == age) {
+            ee_write(SD_Mark, cur->adr, &sfq_done, 1);
+            cur->busy = NO;
+            sfq_stat.queued--;
+            if (done)
+                sfq_stat.forwarded++;
+            else
+                sfq_stat.dropped++;
+        }
+        sfq_unlock();
+        proceed SD_Pick;
+
+    /*
+     * Purpose: Program the staged bytes, so that they survive a reset.
+    */
+    state SD_Idle:
+        if (sfq_tail == sfq_wr)
+            proceed SD_Wait;
+        sfq_lock(SD_Idle);
+
+    state SD_Idle_Flush:
+        sfq_flush(SD_Idle_Flush);
+        sfq_unlock();
+        proceed SD_Wait;
+}
+
+void sfq_reset (void) {
+    sfq_stat.stored = sfq_stat.forwarded = sfq_stat.dropped = 0;
+    sfq_stat.pages = sfq_stat.erases = 0;
+}
@@ -0,0 +1,94 @@
+/* --------------------------------------------
+ * Purpose: Store-and-forward queue in the SPI flash. A direct message
+ *          that its receiver never acknowledged is appended to a log in
+ *          the flash (sfq_put) and sent again by sfq_drain once the
+ *          receiver is heard from (the mesh has a fresh route or it is a
+ *          neighbor), also after a reboot. It is sent reliably only, so
+ *          sfq_drain waits while reliable mode is off. A message that is
+ *          still not acknowledged is tried again after SFQ_BACKOFF sec,
+ *          doubled after each attempt; after SFQ_TRIES attempts (counted
+ *          since the last boot) it is dropped.
+ *
+ *          The log is a ring of SFQ_SECTORS erase sectors. Each sector
+ *          starts with a header (SFQ_MAGIC and a serial number, which
+ *          orders the sectors at boot) followed by entries:
+ *
+ *            mark, priority, receiver (word), length (word), text
+ *
+ *          An entry is never rewritten: delivering it only programs its
+ *          mark from SFQ_LIVE to SFQ_DONE. Appended bytes are collected
+ *          in a RAM copy of the flash page they go to and programmed a
+ *          whole page at a time, or every SFQ_POLL msec for the last,
+ *          partial page. When the writer moves on to a sector, sfq_drain
+ *          erases the one after it (unless it is still blank from
+ *          formatting), dropping the messages still queued there, so an
+ *          append only waits for an erase if it fills a whole sector
+ *          before that erase is done.
+ *
+ *          The entries still queued are indexed in RAM (at most SFQ_MAX),
+ *          so finding one for a reachable receiver reads no flash. Those
+ *          found at boot that do not fit into the index are dropped and
+ *          marked delivered.
+ -----------------------------------------------*/
+#ifndef __sfq_h__
+#define __sfq_h__
+
+#include "sysio.h"
+#include "app.h"
+
+// Flash area: SFQ_SECTORS erase sectors from SFQ_BASE
+#define SFQ_BASE 0
+#define SFQ_SECTOR 4096
+#ifndef SFQ_SECTORS
+#define SFQ_SECTORS 16
+#endif
+#define SFQ_SIZE ((lword)SFQ_SECTORS * SFQ_SECTOR)
+
+// Program page of the flash
+#define SFQ_PAGE 256
+
+// Messages queued at most
+#ifndef SFQ_MAX
+#define SFQ_MAX 16
+#endif
+
+// Attempts to send a queued message before it is dropped, and the wait
+// after the first failed one (sec), doubled after every further one
+#define SFQ_TRIES 6
+#define SFQ_BACKOFF 4
+
+// Interval of the receiver checks and of programming a partial page (msec)
+#define SFQ_POLL 2048
+
+// Sector header
+#define SFQ_MAGIC 0x5346
+#define SFQ_SHDR 4
+
+// Entry marks; erased flash reads SFQ_FREE
+#define SFQ_FREE 0xFF
+#define SFQ_LIVE 0x7F
+#define SFQ_DONE 0x00
+
+// Entry header
+#define SFQ_EHDR 6
+
+typedef struct {
+    word queued;
+    lword stored, forwarded, dropped;
+    lword pages, erases; // flash program and erase operations
+} sfqstat_t;
+
+extern sfqstat_t sfq_stat;
+// Queue direct messages that were not acknowledged
+extern Boolean sfq_on;
+
+fsm sfq_put (struct outmsg*);
+fsm sfq_drain;
+
+// The flash is shared with the history log (see his.h)
+void sfq_lock (word);
+void sfq_unlock (void);
+void sfq_wait (word);
+void sfq_reset (void);
+
+#endif
@@ -0,0 +1,70 @@
+#!/usr/bin/env tclsh
+#
+# Summarizes a broadcast flooding benchmark from the console logs of the
+# nodes of one simulated network, one log file per node.
+#
+# Usage:
+#   tclsh sim/floodsum.tcl node1.log node2.log ...
+#
+# Every log is scanned for the CSV lines of the app:
+#
+#   tx,0,...     broadcast traffic tests started on the node (sent count)
+#   rxsum,...    benchmark messages received, printed by (S)tatistics
+#   mesh,...     relay counters printed by (S)tatistics
+#
+# The per-message rx lines are not counted: the console drops them when it
+# falls behind, which is exactly what happens under heavy flooding.
+#
+# and one CSV line is written:
+#
+#   nodes,sent,delivered,delivery_ratio,forwarded,suppressed,
+#   suppression_factor,relays_per_msg
+#
+# delivery_ratio is delivered / (sent * (nodes - 1)); suppression_factor
+# is the share of rebroadcasts that were suppressed; relays_per_msg is
+# the number of rebroadcasts per message sent (nodes - 1 for plain
+# flooding).
+#
+
+if { [llength $argv] < 2 } {
+	puts stderr "usage: floodsum.tcl log log ..."
+	exit 1
+}
+
+set sent 0
+set delivered 0
+set forwarded 0
+set suppressed 0
+
+foreach f $argv {
+	set fd [open $f r]
+	while { [gets $fd line] >= 0 } {
+		set v [split [string trim $line] ","]
+		switch -- [lindex $v 0] {
+			tx {
+				if { [lindex $v 1] == 0 } {
+					incr sent [lindex $v 3]
+				}
+			}
+			rxsum {
+				incr delivered [lindex $v 1]
+			}
+			mesh {
+				incr forwarded [lindex $v 4]
+				incr suppressed [lindex $v 5]
+			}
+		}
+	}
+	close $fd
+}
+
+set nodes [llength $argv]
+set expected [expr { $sent * ($nodes - 1) }]
+set relays [expr { $forwarded + $suppressed }]
+
+puts "# nodes,sent,delivered,delivery_ratio,forwarded,suppressed,suppression_factor,relays_per_msg"
+puts [format "%d,%d,%d,%.3f,%d,%d,%.3f,%.2f" $nodes $sent $delivered \
+	[expr { $expected ? double ($delivered) / $expected : 0.0 }] \
+	$forwarded $suppressed \
+	[expr { $relays ? double ($suppressed) / $relays : 0.0 }] \
+	[expr { $sent ? double ($forwarded) / $sent : 0.0 }]]
@@ -0,0 +1,121 @@
+#!/usr/bin/env tclsh
+#
+# Generates a VUEE data file for a network of many chat nodes.
+#
+# Usage:
+#   tclsh sim/gentopo.tcl ?-n nodes? ?-l grid|random? ?-d spacing? \
+#                         ?-s sigma? ?-b bitrate? ?-o file?
+#
+#   -n  number of nodes (default 25, one cell as deployed today)
+#   -l  layout: nodes on a square grid or uniformly random (default grid)
+#   -d  grid spacing in metres; for random, the side of the square area
+#       is spacing * sqrt(nodes) (default 10.0)
+#   -s  shadowing sigma in dB, i.e., how much the loss of individual
+#       links varies around the path loss curve (default 4.0)
+#   -b  channel bit rate; 50000 matches the rfprop.c default (default 50000)
+#   -o  output file (default: standard output)
+#
+# Collisions and airtime are modelled by VUEE itself: frames overlapping
+# at a receiver interfere according to their received power, and every
+# frame occupies the channel for (preamble + length) / bitrate.
+#
+
+set nodes 25
+set layout grid
+set spacing 10.0
+set sigma 4.0
+set bitrate 50000
+set outfile ""
+
+foreach {opt val} $argv {
+	switch -- $opt {
+		-n { set nodes $val }
+		-l { set layout $val }
+		-d { set spacing $val }
+		-s { set sigma $val }
+		-b { set bitrate $val }
+		-o { set outfile $val }
+		default {
+			puts stderr "unknown option $opt"
+			exit 1
+		}
+	}
+}
+
+if { $nodes < 1 || ($layout != "grid" && $layout != "random") } {
+	puts stderr "illegal parameters"
+	exit 1
+}
+
+if { $outfile == "" } {
+	set fd stdout
+} else {
+	set fd [open $outfile w]
+}
+
+set side [expr { int (ceil (sqrt ($nodes))) }]
+
+puts $fd "<!-- generated by gentopo.tcl: $nodes nodes, $layout, spacing $spacing m, sigma $sigma dB, $bitrate bps -->"
+puts $fd "<network nodes=\"$nodes\" radio=\"1\">"
+puts $fd "  <grid>0.1m</grid>"
+puts $fd "  <channel bn=\"-115.0dBm\" bitrate=\"$bitrate\">"
+puts $fd "    <propagation type=\"shadowing\" syncbits=\"32\">"
+puts $fd "      -10.0 1.0m ${sigma}dB -20.0dBm"
+puts $fd "    </propagation>"
+puts $fd "    <ber>"
+puts $fd "      -10.0dB 0.0"
+puts $fd "      -20.0dB 1.0"
+puts $fd "    </ber>"
+puts $fd "    <frame>"
+puts $fd "      32 0 2"
+puts $fd "    </frame>"
+puts $fd "    <rssi>"
+puts $fd "      -128dBm 0"
+puts $fd "        0dBm 255"
+puts $fd "    </rssi>"
+puts $fd "    <power>"
+puts $fd "      0 10.0dBm"
+puts $fd "    </power>"
+puts $fd "    <cutoff>-115.0dBm</cutoff>"
+puts $fd "  </channel>"
+puts $fd "  <nodes>"
+puts $fd "    <defaults>"
+puts $fd "      <memory>20480 bytes</memory>"
+# The SPI flash of the store-and-forward queue and the history (MX25R8035)
+puts $fd "      <eeprom size=\"1048576\" clean=\"ff\"></eeprom>"
+puts $fd "      <radio>"
+puts $fd "        <power>0</power>"
+puts $fd "        <rate>0</rate>"
+puts $fd "        <channel>0</channel>"
+puts $fd "        <backoff>"
+puts $fd "          min=8 max=64"
+puts $fd "        </backoff>"
+puts $fd "        <lbt>"
+puts $fd "          delay=8 threshold=-109.0dBm"
+puts $fd "        </lbt>"
+puts $fd "      </radio>"
+puts $fd "      <uart rate=\"115200\" bsize=\"256\">"
+puts $fd "        <input source=\"socket\"></input>"
+puts $fd "        <output target=\"socket\"></output>"
+puts $fd "      </uart>"
+puts $fd "    </defaults>"
+
+for { set i 0 } { $i < $nodes } { incr i } {
+	if { $layout == "grid" } {
+		set x [expr { ($i % $side) * $spacing }]
+		set y [expr { ($i / $side) * $spacing }]
+	} else {
+		set x [expr { rand () * $side * $spacing }]
+		set y [expr { rand () * $side * $spacing }]
+	}
+	puts $fd "    <node number=\"$i\" hid=\"[expr { $i + 1 }]\" start=\"on\">"
+	puts $fd [format "      <location>%.1f %.1f</location>" $x $y]
+	puts $fd "    </node>"
+}
+
+puts $fd "  </nodes>"
+puts $fd "</network>"
+
+if { $fd != "stdout" } {
+	close $fd
+}
@@ -0,0 +1,141 @@
+/* --------------------------------------------
+ * Purpose: Buffered console output (see uout.h).
+ -----------------------------------------------*/
+#include "sysio.h"
+#include "uout.h"
+
+#if UOUT_SIZE & (UOUT_SIZE - 1)
+#error "UOUT_SIZE must be a power of two"
+#endif
+
+static char uout_buf [UOUT_SIZE];
+// Running counts of the bytes put in and taken out; their difference is
+// what waits in the ring
+static word uout_in, uout_out;
+
+// uout_tx is in the middle of a line
+static Boolean uout_busy;
+
+uoutstat_t uout_stat;
+Boolean uout_bin;
+
+// Events: text was added / room was made / a line has gone out
+#define UOUT_EV_DATA ((aword)&uout_in)
+#define UOUT_EV_ROOM ((aword)&uout_out)
+#define UOUT_EV_FREE ((aword)&uout_busy)
+
+/*
+ * Purpose: Write out the ring, as much as the UART takes at a time, one
+ *          line (up to a '\r') after another, or all of it in binary mode.
+*/
+fsm uout_tx {
+    state UO_Wait:
+        if (uout_in == uout_out) {
+            when(UOUT_EV_DATA, UO_Wait);
+            release;
+        }
+
+    state UO_Lock:
+        // Between lines, output started by ser_outf goes first
+        if (!uout_busy && running(__outserial)) {
+            join(running(__outserial), UO_Lock);
+            release;
+        }
+        uout_busy = YES;
+
+    state UO_Write:
+        word at = uout_out & (UOUT_SIZE - 1);
+        word n = uout_in - uout_out;
+        word k;
+        if (n > UOUT_SIZE - at)
+            n = UOUT_SIZE - at;
+        for (k = 0; k < n && !uout_bin; k++)
+            if (uout_buf [at + k] == '\r') {
+                n = k + 1;
+                break;
+            }
+        uout_out += io(UO_Write, UART_A, WRITE, uout_buf + at, n);
+        trigger(UOUT_EV_ROOM);
+        // At the end of a line, or of what there is, let ser_outf in
+        if ((!uout_bin && uout_buf [(uout_out - 1) & (UOUT_SIZE - 1)] == '\r') ||
+            uout_in == uout_out) {
+                uout_busy = NO;
+                trigger(UOUT_EV_FREE);
+        }
+        proceed UO_Wait;
+}
+
+void uout_init () {
+    uout_in = uout_out = 0;
+    runfsm uout_tx;
+}
+
+word uout_used () {
+    return uout_in - uout_out;
+}
+
+/*
+ * Purpose: Copy n bytes into the ring, which has room for them.
+*/
+static void uout_copy (const char *p, word n) {
+    word at = uout_in & (UOUT_SIZE - 1);
+    word first = n < UOUT_SIZE - at ? n : UOUT_SIZE - at;
+
+    memcpy(uout_buf + at, p, first);
+    memcpy(uout_buf, p + first, n - first);
+    uout_in += n;
+    if (uout_used() > uout_stat.maxused)
+        uout_stat.maxused = uout_used();
+    trigger(UOUT_EV_DATA);
+}
+
+/*
+ * Purpose: Return YES if n bytes can be queued now, otherwise count a
+ *          dropped line and return NO.
+*/
+Boolean uout_reserve (word n) {
+    if (n > UOUT_SIZE - uout_used()) {
+        uout_stat.dropped++;
+        return NO;
+    }
+    return YES;
+}
+
+/*
+ * Purpose: Queue a line of n bytes, or drop it if it does not fit.
+ *          Returns YES if it was queued.
+*/
+Boolean uout_put (const char *p, word n) {
+    if (!uout_reserve(n))
+        return NO;
+    uout_copy(p, n);
+    return YES;
+}
+
+/*
+ * Purpose: Queue n bytes (at most UOUT_SIZE). If there is no room for
+ *          them yet, the caller is resumed in state st when text has
+ *          gone out.
+*/
+void uout_write (word st, const char *p, word n) {
+    if (n > UOUT_SIZE - uout_used()) {
+        when(UOUT_EV_ROOM, st);
+        release;
+    }
+    uout_copy(p, n);
+}
+
+/*
+ * Purpose: Wait in state st while uout_tx is in the middle of a line.
+*/
+void uout_lock (word st) {
+    if (uout_busy) {
+        when(UOUT_EV_FREE, st);
+        release;
+    }
+}
+
+void uout_reset () {
+    uout_stat.maxused = uout_used();
+    uout_stat.dropped = 0;
+}
@@ -0,0 +1,52 @@
+/* --------------------------------------------
+ * Purpose: Buffered console output. Text is queued in a ring buffer
+ *          and written out to the UART by a process of its own, so the
+ *          process producing it does not wait for the console.
+ *
+ *          uout_put queues a line without ever waiting: if the ring has
+ *          no room for the whole line, the line is dropped and counted.
+ *          A line queued in pieces is checked with uout_reserve first, so
+ *          it is dropped whole. uout_write, for text that must not be
+ *          lost, waits for room like the other blocking calls.
+ *
+ *          The menu and reports still go out through ser_outf, which
+ *          uout_serf makes wait while uout_tx is in the middle of a line;
+ *          uout_tx in turn waits while ser_outf's output is going out, so
+ *          the two never mix within a line. In binary mode (uout_bin,
+ *          for the host link), the ring is not split into lines, as its
+ *          frames may hold '\r' bytes: ser_outf waits until it is empty.
+ -----------------------------------------------*/
+#ifndef __uout_h__
+#define __uout_h__
+
+#include "sysio.h"
+#include "ser.h"
+#include "serf.h"
+
+// Ring size (bytes, a power of two)
+#ifndef UOUT_SIZE
+#define UOUT_SIZE 512
+#endif
+
+typedef struct {
+    word maxused; // most bytes ever waiting in the ring
+    lword dropped; // lines dropped by uout_put/uout_reserve
+} uoutstat_t;
+
+extern uoutstat_t uout_stat;
+// The ring holds binary frames rather than lines
+extern Boolean uout_bin;
+
+void uout_init (void);
+word uout_used (void);
+Boolean uout_reserve (word);
+Boolean uout_put (const char*, word);
+void uout_write (word, const char*, word);
+void uout_reset (void);
+void uout_lock (word);
+
+// ser_outf, not in the middle of a line from the ring
+#define uout_serf(st, ...) do { uout_lock(st); ser_outf(st, __VA_ARGS__); } \
+    while (0)
+
+#endif